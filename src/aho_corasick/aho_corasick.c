@@ -19,9 +19,26 @@
 /*
  * This code should compile by doing:
  *
- * $ cc -o aho_corasick aho_corasick.c keyword_tree.c dynamic_array.c fasta_file.c
+ * $ cc -pthread -o aho_corasick aho_corasick.c keyword_tree.c dynamic_array.c fasta_file.c -lz
  *
- * and it should work with any C compiler with c99 and the POSIX function getline.
+ * and it should work with any C compiler with c99 and POSIX threads.
+ * The option "-t" gives the number of threads used to read the FASTA
+ * files (see fasta_file.c); by default there is one per processor.
+ *
+ * By default only the number of matches is found and printed. With
+ * "-p" each match is printed as the name of the text, the start of
+ * the match and the name of the pattern; with "-c" the number of
+ * matches of each pattern is printed; and with "-k 10" the search
+ * stops after the first 10 matches. Each of these is a different
+ * kind of "sink" for the matches (see keyword_tree.h).
+ *
+ * With "-R" the reverse complement of each pattern is put in the tree
+ * too, so both strands are searched in one pass over the text, and
+ * "-p" gives the strand ('+' or '-') of each match. A pattern that is
+ * its own reverse complement is only put in once, and its matches are
+ * on the '+' strand. If the reverse complement of one pattern is
+ * another of the patterns, a match is reported as that pattern on the
+ * '+' strand, and not also as the first on the '-' strand.
  */
 
 #include "fasta_file.h"
@@ -30,48 +47,156 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+
+#include <unistd.h>
+
+
+static const char usage[] =
+  "aho_corasick [-t threads] [-R] [-p | -c | -k max] "
+  "<patterns-fasta> <texts-fasta>\n";
+
+
+static char
+complement(const char c) {
+  switch (c) {
+  case 'A': return 'T';
+  case 'C': return 'G';
+  case 'G': return 'C';
+  case 'T': return 'A';
+  case 'a': return 't';
+  case 'c': return 'g';
+  case 'g': return 'c';
+  case 't': return 'a';
+  }
+  return c;
+}
 
 
-int main(const int argc, const char **argv) {
+// the reverse complement of the pattern, which must be freed
+static char *
+reverse_complement(const char *pattern) {
+  const size_t n = strlen(pattern);
+  char *rc = malloc(n + 1);
+  for (size_t i = 0; i < n; ++i)
+    rc[i] = complement(pattern[n - 1 - i]);
+  rc[n] = '\0';
+  return rc;
+}
+
 
-  if (argc < 2) {
-    fprintf(stderr, "aho_corasic <patterns-fasta> <texts-fasta>\n");
+int main(const int argc, char * const argv[]) {
+
+  int n_threads = 0;
+  bool both_strands = false;
+  kw_sink sink = {0};
+  sink.kind = kw_sink_count;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:Rpck:")) != -1) {
+    if (opt == 't')
+      n_threads = atoi(optarg);
+    else if (opt == 'R')
+      both_strands = true;
+    else if (opt == 'p')
+      sink.kind = kw_sink_writer;
+    else if (opt == 'c')
+      sink.kind = kw_sink_histogram;
+    else if (opt == 'k') {
+      sink.kind = kw_sink_first_k;
+      sink.k = strtoul(optarg, NULL, 10);
+    }
+    else {
+      fprintf(stderr, "%s", usage);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind < 2) {
+    fprintf(stderr, "%s", usage);
     return EXIT_FAILURE;
   }
 
-  char **pattern_names = NULL;
-  char **patterns = NULL;
-  const size_t n_patterns = read_fasta_file(argv[1], &pattern_names, &patterns);
+  fasta_file *patterns = fasta_file_read(argv[optind], n_threads);
+  if (patterns == NULL) {
+    fprintf(stderr, "problem with file: %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  const size_t n_patterns = fasta_file_n_seqs(patterns);
 
-  // for (int i = 0; i < n_patterns; ++i)
-  //   printf(">%s\n%s\n", pattern_names[i], patterns[i]);
+  // for (size_t i = 0; i < n_patterns; ++i)
+  //   printf(">%s\n%s\n", fasta_file_name(patterns, i),
+  //          fasta_file_seq(patterns, i));
 
-  char **text_names = NULL;
-  char **texts = NULL;
-  const size_t n_texts = read_fasta_file(argv[2], &text_names, &texts);
+  fasta_file *texts = fasta_file_read(argv[optind + 1], n_threads);
+  if (texts == NULL || fasta_file_n_seqs(texts) == 0) {
+    fprintf(stderr, "problem with file: %s\n", argv[optind + 1]);
+    fasta_file_free(patterns);
+    fasta_file_free(texts);
+    return EXIT_FAILURE;
+  }
 
-  // const size_t text_length = strlen(texts[0]);
+  // const size_t text_length = fasta_file_seq_length(texts, 0);
   // printf("n_texts=%d\ntext_length=%d\n", n_texts, text_length);
 
   kw_tree* the_tree = kw_tree_init();
 
   for (size_t i = 0; i < n_patterns; ++i)
-    kw_tree_insert(the_tree, patterns[i], i + 1);
+    kw_tree_insert(the_tree, fasta_file_seq(patterns, i), i + 1);
+
+  // The reverse complements are numbered after the patterns. A pattern
+  // that is the reverse complement of another (or the same as another
+  // pattern) ends at the same node, which keeps the numbers of both,
+  // so each is reported for its own pattern and strand.
+  if (both_strands) {
+    sink.n_forward = n_patterns;
+    for (size_t i = 0; i < n_patterns; ++i) {
+      const char *pattern = fasta_file_seq(patterns, i);
+      char *rc = reverse_complement(pattern);
+      if (strcmp(rc, pattern) != 0)
+        kw_tree_insert(the_tree, rc, n_patterns + i + 1);
+      free(rc);
+    }
+  }
 
   kw_tree_set_links(the_tree);
 
-  dynamic_array *matches = kw_tree_search(the_tree, texts[0]);
+  // the pattern numbers start at 1 in the tree
+  const char **names = calloc(n_patterns + 1, sizeof(const char *));
+  for (size_t i = 0; i < n_patterns; ++i)
+    names[i + 1] = fasta_file_name(patterns, i);
+
+  if (sink.kind == kw_sink_first_k)
+    sink.matches = da_init();
+  else if (sink.kind == kw_sink_histogram)
+    sink.histogram = calloc(both_strands ? 2*n_patterns + 1 : n_patterns + 1,
+                            sizeof(size_t));
+  else if (sink.kind == kw_sink_writer) {
+    // a big buffer, so there are few calls to write
+    setvbuf(stdout, NULL, _IOFBF, 1 << 22);
+    sink.out = stdout;
+    sink.text_name = fasta_file_name(texts, 0);
+    sink.names = names;
+  }
 
-  kw_tree_free(the_tree);
+  kw_tree_search_sink(the_tree, fasta_file_seq(texts, 0), &sink);
 
-  free_fasta_data(n_patterns, pattern_names, patterns);
-  free_fasta_data(n_texts, text_names, texts);
+  // the count for each pattern includes its reverse complement
+  if (sink.kind == kw_sink_histogram)
+    for (size_t i = 0; i < n_patterns; ++i)
+      printf("%.*s\t%zu\n", (int)strcspn(names[i + 1], " \t"), names[i + 1],
+             sink.histogram[i + 1] +
+             (both_strands ? sink.histogram[n_patterns + i + 1] : 0));
+  printf("%zu\n", sink.count);
+
+  kw_tree_free(the_tree);
 
-  /* for (int i = 0; i < da_size(matches); ++i) */
-  /*   printf("matches[i]=%d\n", da_element_at(matches, i)); */
-  printf("%d\n", da_size(matches));
+  free(names);
+  free(sink.histogram);
+  if (sink.matches != NULL)
+    da_free(sink.matches);
 
-  da_free(matches);
+  fasta_file_free(patterns);
+  fasta_file_free(texts);
 
   return 0;
 }
@@ -21,89 +21,441 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #ifdef max
 #undef max
 #endif
 #define max(a,b) ((a) > (b) ? (a) : (b))
 
+#ifdef min
+#undef min
+#endif
+#define min(a,b) ((a) < (b) ? (a) : (b))
 
-void
-free_fasta_data(const size_t n_seqs, char **seq_names, char **seqs) {
-  for (size_t i = 0; i < n_seqs; ++i) {
-    free(seq_names[i]);
-    free(seqs[i]);
-  }
-  free(seq_names);
-  free(seqs);
+/* ADS: the file is mapped, cut into chunks that each start at a '>'
+ * beginning a line, and each chunk is parsed by its own thread. The
+ * trick that lets the threads work without talking to each other is
+ * that a record never takes more space in the arena than it does in
+ * the file: the '>' and the newline after the name make room for the
+ * two '\0' characters, and the newlines in the sequence are dropped.
+ * So each chunk can write its records in the arena starting at the
+ * same offset where the chunk starts in the file. The only exception
+ * is the very last record when the file does not end in a newline,
+ * which is why the arena has one extra byte.
+ */
+
+// chunks smaller than this are not worth a thread
+static const size_t MIN_CHUNK_SIZE = 1 << 20;
+static const size_t ENTRIES_CAPACITY_INIT = 1024;
+
+typedef struct {
+  size_t name;     // offsets in the arena
+  size_t seq;
+  size_t seq_len;
+} fasta_entry;
+
+struct fasta_file {
+  char *arena;
+  fasta_entry *entries;
+  size_t n_seqs;
+};
+
+typedef struct {
+  const char *data;      // the whole mapped file
+  size_t begin;          // this chunk is [begin, end) in the file
+  size_t end;
+  char *arena;
+  fasta_entry *entries;  // the records found in this chunk
+  size_t n;
+  size_t cap;
+  int failed;
+} fasta_chunk;
+
+
+size_t fasta_file_n_seqs(const fasta_file *ff) {
+  return ff->n_seqs;
 }
 
 
-int
-read_fasta_file(const char *filename, char ***names_out, char ***seqs_out) {
-  static const size_t BUFFER_SIZE = 1024;
-  static const size_t SEQS_CAPACITY_INIT = 8;
+const char *fasta_file_name(const fasta_file *ff, const size_t i) {
+  return ff->arena + ff->entries[i].name;
+}
 
-  FILE *in = fopen(filename, "r");
-  if (in == NULL)
-    return -1;
 
-  size_t n_seqs = 0;
-  size_t seqs_cap = SEQS_CAPACITY_INIT;
+const char *fasta_file_seq(const fasta_file *ff, const size_t i) {
+  return ff->arena + ff->entries[i].seq;
+}
 
-  char **names = calloc(seqs_cap, sizeof(char*));
-  char **seqs = calloc(seqs_cap, sizeof(char*));
 
-  size_t seq_len = 0;
-  size_t seq_cap = BUFFER_SIZE;  // does not include '\0'
+size_t fasta_file_seq_length(const fasta_file *ff, const size_t i) {
+  return ff->entries[i].seq_len;
+}
 
-  char *buffer = NULL;
-  size_t buffer_cap = 0;
-  while (getline(&buffer, &buffer_cap, in) > 0) {
-    const size_t line_width = strcspn(buffer, "\n");
 
-    if (buffer[0] == '>') {
+void fasta_file_free(fasta_file *ff) {
+  if (ff == NULL) return;
+  free(ff->arena);
+  free(ff->entries);
+  free(ff);
+}
+
 
-      // if we will overflow our capacity, grow the arrays
-      if (n_seqs >= seqs_cap) {
-        seqs_cap *= 2;
-        seqs = realloc(seqs, seqs_cap*sizeof(char*));
-        names = realloc(names, seqs_cap*sizeof(char*));
+// Any lines before the first '>' of the file are skipped, and so is a
+// '\r' at the end of a line.
+static void *parse_chunk(void *arg) {
+  fasta_chunk *c = arg;
+  const char *p = c->data + c->begin;
+  const char *const lim = c->data + c->end;
+  char *out = c->arena + c->begin;
+
+  while (p < lim) {
+    const char *eol = memchr(p, '\n', lim - p);
+    if (eol == NULL)
+      eol = lim;
+    size_t width = eol - p;
+    if (width > 0 && p[width - 1] == '\r')
+      --width;
+
+    if (*p == '>') {
+      // end the previous sequence
+      if (c->n > 0) {
+        c->entries[c->n - 1].seq_len = (out - c->arena) - c->entries[c->n - 1].seq;
+        *out++ = '\0';
       }
+      if (c->n == c->cap) {
+        c->cap = max(ENTRIES_CAPACITY_INIT, 2*c->cap);
+        fasta_entry *e = realloc(c->entries, c->cap*sizeof(fasta_entry));
+        if (e == NULL) {
+          c->failed = 1;
+          return NULL;
+        }
+        c->entries = e;
+      }
+      c->entries[c->n].name = out - c->arena;
+      memcpy(out, p + 1, width - 1);
+      out += width - 1;
+      *out++ = '\0';
+      c->entries[c->n].seq = out - c->arena;
+      ++c->n;
+    }
+    else if (c->n > 0) {
+      memcpy(out, p, width);
+      out += width;
+    }
+    p = (eol < lim) ? eol + 1 : lim;
+  }
+  if (c->n > 0) {
+    c->entries[c->n - 1].seq_len = (out - c->arena) - c->entries[c->n - 1].seq;
+    *out = '\0';
+  }
+  return NULL;
+}
+
+
+/* ADS: a file compressed with gzip or bgzip (the first two bytes tell
+ * us) is decompressed into memory first, and the chunks are then cut
+ * from that memory. A bgzip (BGZF) file is a series of gzip blocks,
+ * each with at most 64KB of text, and the header of each block gives
+ * its size. So all the blocks can be found before decompressing any
+ * of them, and the threads each take the next block not yet taken.
+ */
+
+typedef struct {
+  const unsigned char *z;   // the compressed file
+  size_t *starts;           // where each block starts in z
+  size_t *text_offsets;     // where its text goes (n_blocks + 1 of these)
+  size_t n_blocks;
+  size_t next_block;        // the next one not yet taken
+  char *text;
+  int failed;
+} bgzf_job;
+
 
-      // allocate space for the sequence name
-      names[n_seqs] = calloc(line_width, sizeof(char));
+static uint32_t read_u32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+// size of the BGZF block at p, or 0 if there isn't one in n bytes
+static size_t bgzf_block_size(const unsigned char *p, const size_t n) {
+  if (n < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4))
+    return 0;
+  const size_t xlen = p[10] | (p[11] << 8);
+  if (n < 12 + xlen) return 0;
+  for (size_t i = 12; i + 4 <= 12 + xlen;) {
+    const size_t slen = p[i + 2] | (p[i + 3] << 8);
+    if (p[i] == 'B' && p[i + 1] == 'C' && slen == 2 && i + 6 <= 12 + xlen)
+      return (p[i + 4] | (p[i + 5] << 8)) + 1;
+    i += 4 + slen;
+  }
+  return 0;
+}
 
-      // skip the '>' character in the buffer when copying the name
-      strncpy(names[n_seqs], buffer + 1, line_width - 1);
 
-      // allocate space for the sequence to follow
-      seq_cap = BUFFER_SIZE;
-      seqs[n_seqs] = calloc(seq_cap + 1, sizeof(char));
-      seq_len = 0;
+static void *inflate_bgzf_blocks(void *arg) {
+  bgzf_job *job = arg;
+  z_stream s;
+  memset(&s, 0, sizeof(s));
+  // raw deflate data: the gzip header and trailer are handled here
+  if (inflateInit2(&s, -15) != Z_OK) {
+    job->failed = 1;
+    return NULL;
+  }
+  size_t i = 0;
+  while (!job->failed &&
+         (i = __atomic_fetch_add(&job->next_block, 1, __ATOMIC_RELAXED)) <
+         job->n_blocks) {
+    const unsigned char *b = job->z + job->starts[i];
+    const size_t bsize = job->starts[i + 1] - job->starts[i];
+    const size_t header = 12 + (b[10] | (b[11] << 8));
+    const size_t text_size = job->text_offsets[i + 1] - job->text_offsets[i];
+    unsigned char *dst = (unsigned char *)job->text + job->text_offsets[i];
+    inflateReset(&s);
+    s.next_in = (unsigned char *)b + header;
+    s.avail_in = bsize - header - 8;
+    s.next_out = dst;
+    s.avail_out = text_size;
+    if (inflate(&s, Z_FINISH) != Z_STREAM_END || s.avail_out != 0 ||
+        crc32(0, dst, text_size) != read_u32(b + bsize - 8))
+      job->failed = 1;
+  }
+  inflateEnd(&s);
+  return NULL;
+}
+
 
-      ++n_seqs;
+static char *inflate_bgzf(const unsigned char *z, const size_t zsize,
+                          size_t *text_size, const size_t n_threads) {
+  bgzf_job job;
+  memset(&job, 0, sizeof(job));
+  job.z = z;
+
+  // find all the blocks
+  size_t cap = 1024;
+  job.starts = malloc((cap + 1)*sizeof(size_t));
+  job.text_offsets = malloc((cap + 1)*sizeof(size_t));
+  job.text_offsets[0] = 0;
+  size_t p = 0;
+  while (p < zsize) {
+    const size_t bsize = bgzf_block_size(z + p, zsize - p);
+    if (bsize < 26 || p + bsize > zsize) {
+      free(job.starts);
+      free(job.text_offsets);
+      return NULL;
+    }
+    if (job.n_blocks == cap) {
+      cap *= 2;
+      job.starts = realloc(job.starts, (cap + 1)*sizeof(size_t));
+      job.text_offsets = realloc(job.text_offsets, (cap + 1)*sizeof(size_t));
     }
-    else {
+    job.starts[job.n_blocks] = p;
+    job.text_offsets[job.n_blocks + 1] =
+      job.text_offsets[job.n_blocks] + read_u32(z + p + bsize - 4);
+    ++job.n_blocks;
+    p += bsize;
+  }
+  job.starts[job.n_blocks] = p;
 
-      // check if we need more capacity for the sequence
-      if (seq_len + line_width > seq_cap) {
-        seq_cap = max(2*seq_cap, seq_len + line_width);
-        seqs[n_seqs-1] = realloc(seqs[n_seqs-1], (seq_cap + 1)*sizeof(char));
-      }
+  *text_size = job.text_offsets[job.n_blocks];
+  job.text = malloc(max(1, *text_size));
+
+  const size_t n_workers = max(1, min(n_threads, job.n_blocks));
+  pthread_t *threads = calloc(n_workers, sizeof(pthread_t));
+  int *started = calloc(n_workers, sizeof(int));
+  for (size_t i = 1; i < n_workers; ++i)
+    started[i] = pthread_create(&threads[i], NULL, inflate_bgzf_blocks, &job) == 0;
+  inflate_bgzf_blocks(&job);
+  for (size_t i = 1; i < n_workers; ++i)
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  free(started);
+  free(threads);
+  free(job.starts);
+  free(job.text_offsets);
+
+  if (job.failed) {
+    free(job.text);
+    return NULL;
+  }
+  return job.text;
+}
+
+
+// a plain gzip file is one stream, so it takes one thread; several
+// gzip files joined together ("cat a.gz b.gz") are read as one
+static char *inflate_gzip(const unsigned char *z, const size_t zsize,
+                          size_t *text_size) {
+  z_stream s;
+  memset(&s, 0, sizeof(s));
+  // 15 + 32: the largest window, and expect a gzip header
+  if (inflateInit2(&s, 15 + 32) != Z_OK)
+    return NULL;
+  size_t cap = 4*zsize + (1 << 16);
+  char *text = malloc(cap);
+  size_t filled = 0;
+  s.next_in = (unsigned char *)z;
+  s.avail_in = zsize;
+  int ret = Z_OK;
+  while (text != NULL) {
+    if (filled == cap) {
+      cap *= 2;
+      char *t = realloc(text, cap);
+      if (t == NULL) free(text);
+      text = t;
+      continue;
+    }
+    s.next_out = (unsigned char *)text + filled;
+    s.avail_out = cap - filled;
+    ret = inflate(&s, Z_NO_FLUSH);
+    filled = cap - s.avail_out;
+    if (ret == Z_STREAM_END) {
+      if (s.avail_in == 0) break;
+      inflateReset(&s);  // another gzip file follows
+    }
+    else if (ret != Z_OK && ret != Z_BUF_ERROR) break;
+    else if (s.avail_in == 0 && s.avail_out > 0) break;  // truncated
+  }
+  inflateEnd(&s);
+  if (ret != Z_STREAM_END) {
+    free(text);
+    return NULL;
+  }
+  *text_size = filled;
+  return text;
+}
+
+
+// the first '>' at the start of a line at or after "pos"
+static size_t next_record_start(const char *data, const size_t size,
+                                size_t pos) {
+  if (pos == 0) return 0;
+  while (pos < size) {
+    const char *nl = memchr(data + pos - 1, '\n', size - pos + 1);
+    if (nl == NULL || nl + 1 == data + size)
+      return size;
+    pos = nl + 1 - data;
+    if (data[pos] == '>')
+      return pos;
+    ++pos;
+  }
+  return size;
+}
+
+
+fasta_file *fasta_file_read(const char *filename, const int n_threads) {
+
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = st.st_size;
 
-      // copy the current line into the growing sequence
-      strncpy(seqs[n_seqs-1] + seq_len, buffer, line_width);
-      seq_len += line_width;
-      seqs[n_seqs-1][seq_len] = '\0';  // since realloc won't add '\0'
+  const char *data = NULL;
+  if (size > 0) {
+    void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+      close(fd);
+      return NULL;
     }
+    data = m;
+  }
+  close(fd);
+
+  const size_t n_cpus = (n_threads > 0) ? (size_t)n_threads :
+    (size_t)max(1, sysconf(_SC_NPROCESSORS_ONLN));
+
+  // for a compressed file, "data" becomes the decompressed text
+  char *inflated = NULL;
+  const unsigned char *z = (const unsigned char *)data;
+  if (size >= 2 && z[0] == 0x1f && z[1] == 0x8b) {
+    size_t text_size = 0;
+    inflated = bgzf_block_size(z, size) > 0 ?
+      inflate_bgzf(z, size, &text_size, n_cpus) :
+      inflate_gzip(z, size, &text_size);
+    munmap((void *)data, size);
+    if (inflated == NULL)
+      return NULL;
+    data = inflated;
+    size = text_size;
+  }
+
+  fasta_file *ff = calloc(1, sizeof(fasta_file));
+  ff->arena = malloc(size + 1);
+  if (ff->arena == NULL) {
+    if (inflated != NULL)
+      free(inflated);
+    else if (data != NULL)
+      munmap((void *)data, size);
+    fasta_file_free(ff);
+    return NULL;
   }
 
-  free(buffer);
-  fclose(in);
+  size_t n_chunks = n_cpus;
+  n_chunks = max(1, min(n_chunks, size/MIN_CHUNK_SIZE));
+
+  fasta_chunk *chunks = calloc(n_chunks, sizeof(fasta_chunk));
+  for (size_t i = 0; i < n_chunks; ++i) {
+    chunks[i].data = data;
+    chunks[i].arena = ff->arena;
+    chunks[i].begin = (i == 0) ? 0 :
+      max(chunks[i - 1].begin, next_record_start(data, size, i*size/n_chunks));
+    if (i > 0)
+      chunks[i - 1].end = chunks[i].begin;
+  }
+  chunks[n_chunks - 1].end = size;
+
+  // the first chunk is done by this thread
+  pthread_t *threads = calloc(n_chunks, sizeof(pthread_t));
+  int *started = calloc(n_chunks, sizeof(int));
+  for (size_t i = 1; i < n_chunks; ++i)
+    started[i] = pthread_create(&threads[i], NULL, parse_chunk, &chunks[i]) == 0;
+  parse_chunk(&chunks[0]);
+  for (size_t i = 1; i < n_chunks; ++i) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      parse_chunk(&chunks[i]);
+  }
+  free(started);
+  free(threads);
 
-  *names_out = names;
-  *seqs_out = seqs;
+  if (inflated != NULL)
+    free(inflated);
+  else if (data != NULL)
+    munmap((void *)data, size);
 
-  return n_seqs;
+  // one table for the records of all the chunks, in order
+  int failed = 0;
+  for (size_t i = 0; i < n_chunks; ++i) {
+    ff->n_seqs += chunks[i].n;
+    failed |= chunks[i].failed;
+  }
+  ff->entries = malloc(max(1, ff->n_seqs)*sizeof(fasta_entry));
+  size_t n = 0;
+  for (size_t i = 0; i < n_chunks; ++i) {
+    if (chunks[i].n > 0)
+      memcpy(ff->entries + n, chunks[i].entries,
+             chunks[i].n*sizeof(fasta_entry));
+    n += chunks[i].n;
+    free(chunks[i].entries);
+  }
+  free(chunks);
+
+  if (failed || ff->entries == NULL) {
+    fasta_file_free(ff);
+    return NULL;
+  }
+  return ff;
 }
@@ -21,10 +21,24 @@
 
 #include <stdlib.h>
 
-int
-read_fasta_file(const char *filename, char ***names_out, char ***seqs_out);
+/* All the names and sequences of a FASTA file are kept in a single
+ * block of memory (the "arena"), each one ending with '\0', and a table
+ * of where each of them starts in the arena. So there is one call to
+ * malloc for all the letters, however many sequences there are, and
+ * one call to fasta_file_free releases everything.
+ */
+typedef struct fasta_file fasta_file;
+
+// Read the file using "n_threads" threads (0 means one for each
+// processor). Returns NULL if the file can't be read.
+fasta_file *fasta_file_read(const char *filename, const int n_threads);
+void fasta_file_free(fasta_file *);
+
+size_t fasta_file_n_seqs(const fasta_file *);
 
-void
-free_fasta_data(const size_t n_seqs, char **seq_names, char **seqs);
+// the name is the whole line after the '>', not including the newline
+const char *fasta_file_name(const fasta_file *, const size_t i);
+const char *fasta_file_seq(const fasta_file *, const size_t i);
+size_t fasta_file_seq_length(const fasta_file *, const size_t i);
 
 #endif
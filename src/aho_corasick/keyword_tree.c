@@ -32,10 +32,16 @@ struct kw_node {
   /* All kw_node instances need a "letter", but only those with path
      label corresponding to one of the patterns needs to have "num"
      set. I am using the convention that num > 0 to indicate that a
-     node corresponds to the end of a pattern.
+     node corresponds to the end of a pattern. More than one pattern
+     can end at the same node, if they are the same, or if one is the
+     reverse complement of another with both strands searched. Then
+     "num" is the first of them, and the others are in "more_nums".
    */
   char letter;
   int num;
+  int n_more_nums;
+  int *more_nums;
+  int depth; // the length of the path label
   struct kw_node *failure_link;
   struct kw_node *output_link;
   struct kw_node *parent;
@@ -78,6 +84,7 @@ void kw_node_free(kw_node *subtree_root) {
     free(subtree_root->child);
     subtree_root->child = NULL;
   }
+  free(subtree_root->more_nums);
   free(subtree_root);
   subtree_root = NULL;
 }
@@ -100,7 +107,15 @@ void kw_node_insert(kw_node *subtree_root, const char *pattern,
   // check for end of string here, and set the number for the pattern
   // if we have reached the end
   if (pattern[0] == '\0') {
-    subtree_root->num = index;
+    if (subtree_root->num == 0)
+      subtree_root->num = index;
+    else {
+      // keep the number of each pattern that ends here
+      subtree_root->more_nums =
+        realloc(subtree_root->more_nums,
+                (subtree_root->n_more_nums + 1)*sizeof(int));
+      subtree_root->more_nums[subtree_root->n_more_nums++] = index;
+    }
     return;
   }
 
@@ -112,8 +127,10 @@ void kw_node_insert(kw_node *subtree_root, const char *pattern,
   const int i = dna2int[(int)pattern[0]];
 
   // if needed, initialize child for the corresponding letter
-  if (subtree_root->child[i] == NULL)
+  if (subtree_root->child[i] == NULL) {
     subtree_root->child[i] = kw_node_init(pattern[0]);
+    subtree_root->child[i]->depth = subtree_root->depth + 1;
+  }
 
   // keep inserting suffixes recursively
   kw_node_insert(subtree_root->child[i], pattern + 1, index);
@@ -240,12 +257,106 @@ void kw_tree_set_links(kw_tree *t) {
 
 
 dynamic_array *kw_tree_search(const kw_tree *t, const char *T) {
+  kw_sink s = {0};
+  s.kind = kw_sink_patterns;
+  s.matches = da_init();
+  kw_tree_search_sink(t, T, &s);
+  return s.matches;
+}
+
+
+// the name up to the first space
+static void
+write_name(FILE *out, const char *name) {
+  fwrite(name, 1, strcspn(name, " \t"), out);
+}
+
+
+// A line for a match, formatted here rather than with fprintf, which
+// takes longer than finding the match
+static void
+write_match(const kw_sink *s, const int start, int num) {
+  const bool reverse = s->n_forward > 0 && num > s->n_forward;
+  if (reverse) num -= s->n_forward;
+
+  char digits[16];
+  int n_digits = 0;
+  int x = start;
+  do {
+    digits[n_digits++] = '0' + x % 10;
+    x /= 10;
+  } while (x > 0);
+
+  write_name(s->out, s->text_name);
+  putc('\t', s->out);
+  while (n_digits > 0)
+    putc(digits[--n_digits], s->out);
+  putc('\t', s->out);
+  write_name(s->out, s->names[num]);
+  if (s->n_forward > 0) {
+    putc('\t', s->out);
+    putc(reverse ? '-' : '+', s->out);
+  }
+  putc('\n', s->out);
+}
+
+
+// Give the match of pattern number "num", starting at position
+// "start" of the text, to the sink. The count is a local variable of
+// the search, not in the sink, so the compiler can keep it in a
+// register. Returns true if the search should stop.
+static inline bool
+report_num(kw_sink *s, const kw_sink_kind kind, size_t *count,
+           const int num, const int start) {
+  ++*count;
+  switch (kind) {
+  case kw_sink_count:
+    return false;
+  case kw_sink_first_k:
+    da_push(s->matches, num);
+    return *count >= s->k;
+  case kw_sink_patterns:
+    da_push(s->matches, num);
+    return false;
+  case kw_sink_histogram:
+    ++s->histogram[num];
+    return false;
+  case kw_sink_writer:
+    write_match(s, start, num);
+    return false;
+  }
+  return false;
+}
+
+
+// Report each pattern that ends at node v, which is at position i of
+// the text. Returns true if the search should stop.
+static inline bool
+report_match(kw_sink *s, const kw_sink_kind kind, size_t *count,
+             const kw_node *v, const int i) {
+  const int start = i + 1 - v->depth;
+  if (report_num(s, kind, count, v->num, start))
+    return true;
+  for (int j = 0; j < v->n_more_nums; ++j)
+    if (report_num(s, kind, count, v->more_nums[j], start))
+      return true;
+  return false;
+}
+
+
+// The search itself, with "kind" the same as s->kind. It is inline and
+// only called with a constant "kind", so the switch in report_match
+// is decided by the compiler.
+static inline void
+search_with_sink(const kw_tree *t, const char *T, kw_sink *s,
+                 const kw_sink_kind kind) {
 
   kw_node *w = t->root;
 
-  const int n = strlen(T);
+  // no letters are read if no matches are wanted
+  const int n = (kind == kw_sink_first_k && s->k == 0) ? 0 : (int)strlen(T);
 
-  dynamic_array *da = da_init();
+  size_t count = 0;
   for (int i = 0; i < n; ++i) {
 
     while (w != t->root && !has_child(w, T[i]))
@@ -254,14 +365,37 @@ dynamic_array *kw_tree_search(const kw_tree *t, const char *T) {
     if (has_child(w, T[i]))
       w = w->child[dna2int[(int)T[i]]];
 
-    if (w->num > 0)
-      da_push(da, w->num);
+    if (w->num > 0 && report_match(s, kind, &count, w, i))
+      break;
 
     kw_node *p = w->output_link;
-    while (p != NULL) {
-      da_push(da, p->num);
+    bool full = false;
+    while (p != NULL && !full) {
+      full = report_match(s, kind, &count, p, i);
       p = p->output_link;
     }
+    if (full) break;
+  }
+  s->count = count;
+}
+
+
+void kw_tree_search_sink(const kw_tree *t, const char *T, kw_sink *s) {
+  switch (s->kind) {
+  case kw_sink_count:
+    search_with_sink(t, T, s, kw_sink_count);
+    break;
+  case kw_sink_first_k:
+    search_with_sink(t, T, s, kw_sink_first_k);
+    break;
+  case kw_sink_patterns:
+    search_with_sink(t, T, s, kw_sink_patterns);
+    break;
+  case kw_sink_histogram:
+    search_with_sink(t, T, s, kw_sink_histogram);
+    break;
+  case kw_sink_writer:
+    search_with_sink(t, T, s, kw_sink_writer);
+    break;
   }
-  return da;
 }
@@ -21,6 +21,8 @@
 
 #include "dynamic_array.h"
 
+#include <stdio.h>
+
 static const int alphabet_size = 4;
 static const char int2dna[] = "ACGT";
 
@@ -57,4 +59,36 @@ void kw_tree_set_links(kw_tree *);
 
 dynamic_array *kw_tree_search(const kw_tree *, const char *);
 
+/* What kw_tree_search_sink does with each match it finds. The search
+ * is written once, but the compiler makes a copy of it for each kind
+ * of sink, where the kind is known, so with kw_sink_count the search
+ * only adds one to a number for each match and nothing is stored.
+ */
+typedef enum {
+  kw_sink_count,     // only count the matches
+  kw_sink_first_k,   // keep the first "k" pattern numbers, then stop
+  kw_sink_patterns,  // keep the pattern number of every match
+  kw_sink_histogram, // count the matches of each pattern
+  kw_sink_writer     // write each match to "out" as it is found
+} kw_sink_kind;
+
+typedef struct {
+  kw_sink_kind kind;
+  size_t count;           // the number of matches, for every kind
+  size_t k;               // for kw_sink_first_k
+  dynamic_array *matches; // for kw_sink_first_k and kw_sink_patterns
+  size_t *histogram;      // for kw_sink_histogram, indexed by number
+  // For kw_sink_writer: a line with the text name, the start of the
+  // match and the name of the pattern (names[number]) for each match
+  FILE *out;
+  const char *text_name;
+  const char *const *names;
+  // If both strands are searched, the number of patterns; a number
+  // above this is for the reverse complement of pattern (number -
+  // n_forward), and the writer adds the strand to each line
+  int n_forward;
+} kw_sink;
+
+void kw_tree_search_sink(const kw_tree *, const char *, kw_sink *);
+
 #endif
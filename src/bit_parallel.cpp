@@ -0,0 +1,144 @@
+/* bit_parallel: search a FASTA file for a pattern with the Shift-Or
+ * algorithm, or with BNDM.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Author: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// Compile with:
+//
+// $ c++ -O3 -o bit_parallel bit_parallel.cpp -lz -pthread
+//
+// The algorithms are in bit_parallel.hpp. The FASTA file (or standard
+// input, given as "-") is read in blocks as with "kmp_fasta -s".
+// Shift-Or reads the text once from left to right, so it is given the
+// blocks as they are, and keeps its state from one to the next, like
+// KMP. BNDM (with "-N") jumps ahead in the text, so it is given
+// windows that overlap by |P| - 1 letters (see fasta_window.hpp), as
+// with Boyer-Moore. With "--region" or "--seqs" only those parts of
+// the file are read, as in kmp_fasta. The matches are written as they
+// are found, or only counted (see window_search.hpp).
+//
+// With "-B" the whole text is loaded first and the search is timed
+// with Shift-Or, BNDM and the SIMD naive algorithm (see naive_simd.hpp).
+
+#include "bit_parallel.hpp"
+#include "naive_simd.hpp"
+#include "window_search.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include <getopt.h>
+
+using std::vector;
+using std::string;
+
+using std::begin;
+using std::end;
+
+
+// the search given to search_fasta_file (see window_search.hpp)
+struct bit_parallel_search {
+  template<class Text, class Sink> void
+  operator()(Text &T, Sink &sink) const {
+    if (use_bndm)
+      search_windows(T, bndm(P), sink);
+    else {
+      shift_or M(P);
+      T.for_each_line([&](const char *line, const size_t len,
+                          const size_t pos) {
+        M.scan(line, len, pos, [&](const size_t i) {sink(i);});
+      });
+    }
+  }
+  const string &P;
+  bool use_bndm;
+};
+
+
+// Shift-Or, BNDM and the SIMD naive algorithm, to time with "-B"
+static vector<timed_search>
+benchmark_list(const string &P) {
+  shift_or so(P);
+  const bndm bn(P);
+  const timed_search searches[] = {
+    {"shift_or",
+     [so](const char *t, const size_t m, position_sink &found) mutable {
+      so.search(t, m, [&](const size_t i) {found(i);});
+    }},
+    {"bndm", [bn](const char *t, const size_t m, position_sink &found) {
+      bn.search(t, m, [&](const size_t i) {found(i);});
+    }},
+    {"naive_simd", [P](const char *t, const size_t m, position_sink &found) {
+      naive_search(t, m, P.data(), P.size(),
+                   [&](const size_t i) {found(i);});
+    }}
+  };
+  return vector<timed_search>(begin(searches), end(searches));
+}
+
+
+static void
+print_usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [options] <pattern> <fasta-file>"
+            << std::endl
+            << "options:" << std::endl
+            << "  -N        use BNDM instead of Shift-Or"
+            << std::endl;
+  print_window_search_usage("Shift-Or, BNDM and naive searches");
+}
+
+
+int
+main(int argc, char * const argv[]) {
+
+  bool use_bndm = false;
+  window_search_options wopt;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "Nb:pBr:",
+                            window_search_long_options, nullptr)) != -1) {
+    if (opt == 'N')
+      use_bndm = true;
+    else if (!window_search_option(opt, optarg, wopt)) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind != 2 || wopt.block_size == 0 || argv[optind][0] == '\0') {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    // the text is compared in upper case, so the pattern must be too
+    string P(argv[optind]);
+    std::transform(begin(P), end(P), begin(P), fasta_upper);
+
+    const bit_parallel_search search = {P, use_bndm};
+    search_fasta_file(argv[optind + 1], P.size(), wopt, search,
+                      wopt.benchmark ? benchmark_list(P) :
+                      vector<timed_search>());
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
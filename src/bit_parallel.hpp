@@ -0,0 +1,246 @@
+/* bit_parallel: exact matching by keeping the state of the search as
+ * bits of a machine word, with the Shift-Or and BNDM algorithms.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: in KMP the state of the search is one number, the length of
+// the longest prefix of P that ends where we are in the text. In
+// Shift-Or the state is all the prefixes of P that end where we are:
+// bit i of the state D is 0 if P[0..i] ends here. For the next letter
+// c of the text, every prefix that was there gets one letter longer
+// if the letter after it is c, and that is a shift and an "or":
+//
+//   D = (D << 1) | B[c]
+//
+// where bit i of B[c] is 0 exactly when P[i] is c. There is a match
+// when bit n - 1 is 0. This is the same work for every letter, with
+// no branches and no tables other than B, and the text is read once,
+// in order, so it works on a stream (see "scan" below).
+//
+// BNDM (backward nondeterministic DAWG matching) reads each window of
+// the text from right to left, like Boyer-Moore, and keeps as bits of
+// D the positions of P where the letters read so far occur. It stops
+// when there are none, which is usually after a few letters, and the
+// window moves past everything read so far, except for the longest
+// prefix of P seen as a suffix of what was read. So most of the text
+// is skipped, as with Boyer-Moore, but with the state in bits.
+//
+// For patterns of up to 64 letters, D is one 64-bit word and stays in
+// a register. Longer patterns use as many words as needed, with the
+// shift carrying a bit from one word to the next. The tables have one
+// entry for each letter, with upper and lower case the same, so any
+// other set of letters for a position (e.g. IUPAC codes) could be
+// added by changing only the tables. The pattern must be upper case.
+
+#ifndef BIT_PARALLEL_HPP
+#define BIT_PARALLEL_HPP
+
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstdint>
+
+// B[c] for each letter, as "n_words" words for each; bit i is set when
+// P[i] (or P[n - 1 - i] if "reverse") is c, in either case
+static inline void
+bit_parallel_masks(const std::string &P, const bool reverse,
+                   const size_t n_words, std::vector<uint64_t> &B) {
+  const size_t n = P.length();
+  B.assign(256*n_words, 0);
+  for (size_t i = 0; i < n; ++i) {
+    const size_t b = reverse ? n - 1 - i : i;
+    const uint64_t bit = uint64_t(1) << (b % 64);
+    const unsigned char c = P[i];
+    B[c*n_words + b/64] |= bit;
+    B[static_cast<unsigned char>(std::tolower(c))*n_words + b/64] |= bit;
+  }
+}
+
+
+class shift_or {
+public:
+  explicit shift_or(const std::string &P);
+  size_t size() const {return n;}
+
+  // start again at the beginning of a text
+  void reset() {
+    D.assign(n_words, ~uint64_t(0));
+    active = 0;
+  }
+
+  // Continue the search with T[0..m-1], which is at position "pos" in
+  // the text, calling report(i) for each match, with i the position in
+  // the text. The state carries over from the previous call.
+  template<class Report> void
+  scan(const char *T, const size_t m, const size_t pos, Report report);
+
+  // report(i) for each match in T[0..m-1], in order
+  template<class Report> void
+  search(const char *T, const size_t m, Report report) {
+    reset();
+    scan(T, m, 0, report);
+  }
+
+private:
+  size_t n;
+  size_t n_words;
+  uint64_t high; // bit n - 1 in the last word
+  std::vector<uint64_t> B; // here bit i is 0 when P[i] is c
+  std::vector<uint64_t> D;
+  size_t active; // words above this one in D are all 1s
+};
+
+
+inline
+shift_or::shift_or(const std::string &P) :
+  n(P.length()), n_words((P.length() + 63)/64),
+  high(uint64_t(1) << ((P.length() + 63) % 64)) {
+  bit_parallel_masks(P, false, n_words, B);
+  for (size_t i = 0; i < B.size(); ++i)
+    B[i] = ~B[i];
+  reset();
+}
+
+
+template<class Report> void
+shift_or::scan(const char *T, const size_t m, const size_t pos,
+               Report report) {
+  if (n == 0) return;
+  if (n_words == 1) {
+    uint64_t d = D[0];
+    for (size_t k = 0; k < m; ++k) {
+      d = (d << 1) | B[static_cast<unsigned char>(T[k])];
+      if (!(d & high))
+        report(pos + k - n + 1);
+    }
+    D[0] = d;
+    return;
+  }
+  // In a text that is not very repetitive, only short prefixes of P
+  // are ever there, and the words for longer ones are all 1s. A word of
+  // all 1s stays that way unless the word below it has a 0 at the top,
+  // so only the words up to the last with a 0 (and the one after it,
+  // when that 0 is at the top) are updated.
+  uint64_t *const d = D.data();
+  const uint64_t *const B_all = B.data();
+  const size_t last = n_words - 1;
+  size_t top = active;
+  for (size_t k = 0; k < m; ++k) {
+    const uint64_t *b = B_all + static_cast<unsigned char>(T[k])*n_words;
+    if (top < last && !(d[top] >> 63)) ++top;
+    // from the top word down, so each gets the top bit of the one
+    // below before that one is shifted
+    for (size_t w = top; w > 0; --w)
+      d[w] = (d[w] << 1) | (d[w - 1] >> 63) | b[w];
+    d[0] = (d[0] << 1) | b[0];
+    if (!(d[last] & high))
+      report(pos + k - n + 1);
+    while (top > 0 && d[top] == ~uint64_t(0)) --top;
+  }
+  active = top;
+}
+
+
+class bndm {
+public:
+  explicit bndm(const std::string &P);
+  size_t size() const {return n;}
+
+  template<class Report> void
+  search(const char *T, const size_t m, Report report) const;
+
+private:
+  template<class Report> void
+  search_one_word(const char *T, const size_t m, Report &report) const;
+
+  size_t n;
+  size_t n_words;
+  uint64_t high;     // bit n - 1 in the last word, for the prefix P[0]
+  uint64_t top_mask; // the bits used in the last word
+  std::vector<uint64_t> B; // for P reversed: bit n - 1 - i for P[i]
+};
+
+
+inline
+bndm::bndm(const std::string &P) :
+  n(P.length()), n_words((P.length() + 63)/64),
+  high(uint64_t(1) << ((P.length() + 63) % 64)),
+  top_mask(high | (high - 1)) {
+  bit_parallel_masks(P, true, n_words, B);
+}
+
+
+template<class Report> void
+bndm::search_one_word(const char *T, const size_t m, Report &report) const {
+  for (size_t pos = 0; pos + n <= m;) {
+    // j letters of the window are not yet read, and "last" is where
+    // the next window starts
+    size_t j = n, last = n;
+    uint64_t d = top_mask;
+    while (d != 0) {
+      d &= B[static_cast<unsigned char>(T[pos + j - 1])];
+      --j;
+      if (d & high) {
+        // the letters read are a prefix of P
+        if (j > 0) last = j;
+        else {
+          report(pos);
+          break;
+        }
+      }
+      d <<= 1;
+    }
+    pos += last;
+  }
+}
+
+
+template<class Report> void
+bndm::search(const char *T, const size_t m, Report report) const {
+  if (n == 0) return;
+  if (n_words == 1) {
+    search_one_word(T, m, report);
+    return;
+  }
+  std::vector<uint64_t> d(n_words);
+  for (size_t pos = 0; pos + n <= m;) {
+    size_t j = n, last = n;
+    d.assign(n_words, ~uint64_t(0));
+    d[n_words - 1] = top_mask;
+    for (;;) {
+      const uint64_t *b = &B[static_cast<unsigned char>(T[pos + j - 1])*n_words];
+      uint64_t any = 0;
+      for (size_t w = 0; w < n_words; ++w)
+        any |= (d[w] &= b[w]);
+      if (any == 0) break;
+      --j;
+      if (d[n_words - 1] & high) {
+        if (j > 0) last = j;
+        else {
+          report(pos);
+          break;
+        }
+      }
+      for (size_t w = n_words - 1; w > 0; --w)
+        d[w] = (d[w] << 1) | (d[w - 1] >> 63);
+      d[0] <<= 1;
+      d[n_words - 1] &= top_mask;
+    }
+    pos += last;
+  }
+}
+
+#endif
@@ -0,0 +1,141 @@
+/* boyer_moore: search a FASTA file for a pattern with the Boyer-Moore
+ * algorithm, or with Horspool's version of it.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Author: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// Compile with:
+//
+// $ c++ -O3 -o boyer_moore boyer_moore.cpp -lz -pthread
+//
+// The algorithms are in boyer_moore.hpp. The FASTA file (or standard
+// input, given as "-") is read in blocks as with "kmp_fasta -s", and
+// the blocks are searched in windows that overlap by |P| - 1 letters
+// (see fasta_window.hpp), since Boyer-Moore needs the text it is
+// looking at to be in one place. With "--region" or "--seqs" only
+// those parts of the file are read, as in kmp_fasta. The matches are
+// written as they are found, or only counted, and never kept (see
+// window_search.hpp, which has what this shares with bit_parallel and
+// z_algorithm).
+//
+// With "-B" the whole text is loaded first and the search is timed
+// with Boyer-Moore, Horspool and the SIMD naive algorithm (see
+// naive_simd.hpp), which is how to see which is best for a pattern.
+// For long patterns, Boyer-Moore can be faster than reading every
+// letter of the text, which is the most any of the others can do.
+
+#include "boyer_moore.hpp"
+#include "naive_simd.hpp"
+#include "window_search.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include <getopt.h>
+
+using std::vector;
+using std::string;
+
+using std::begin;
+using std::end;
+
+
+// the search given to search_fasta_file (see window_search.hpp)
+struct boyer_moore_search {
+  template<class Text, class Sink> void
+  operator()(Text &T, Sink &sink) const {
+    if (use_horspool)
+      search_windows(T, horspool(P), sink);
+    else
+      search_windows(T, boyer_moore(P), sink);
+  }
+  const string &P;
+  bool use_horspool;
+};
+
+
+// Boyer-Moore, Horspool and the SIMD naive algorithm, to time with "-B"
+static vector<timed_search>
+benchmark_list(const string &P) {
+  const boyer_moore bm(P);
+  const horspool h(P);
+  const timed_search searches[] = {
+    {"boyer_moore", [bm](const char *t, const size_t m, position_sink &found) {
+      bm.search(t, m, [&](const size_t i) {found(i);});
+    }},
+    {"horspool", [h](const char *t, const size_t m, position_sink &found) {
+      h.search(t, m, [&](const size_t i) {found(i);});
+    }},
+    {"naive_simd", [P](const char *t, const size_t m, position_sink &found) {
+      naive_search(t, m, P.data(), P.size(),
+                   [&](const size_t i) {found(i);});
+    }}
+  };
+  return vector<timed_search>(begin(searches), end(searches));
+}
+
+
+static void
+print_usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [options] <pattern> <fasta-file>"
+            << std::endl
+            << "options:" << std::endl
+            << "  -H        use Horspool's version of the algorithm"
+            << std::endl;
+  print_window_search_usage("Boyer-Moore, Horspool and naive searches");
+}
+
+
+int
+main(int argc, char * const argv[]) {
+
+  bool use_horspool = false;
+  window_search_options wopt;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "Hb:pBr:",
+                            window_search_long_options, nullptr)) != -1) {
+    if (opt == 'H')
+      use_horspool = true;
+    else if (!window_search_option(opt, optarg, wopt)) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind != 2 || wopt.block_size == 0 || argv[optind][0] == '\0') {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    // the text is compared in upper case, so the pattern must be too
+    string P(argv[optind]);
+    std::transform(begin(P), end(P), begin(P), fasta_upper);
+
+    const boyer_moore_search search = {P, use_horspool};
+    search_fasta_file(argv[optind + 1], P.size(), wopt, search,
+                      wopt.benchmark ? benchmark_list(P) :
+                      vector<timed_search>());
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+/* boyer_moore: the Boyer-Moore algorithm for exact matching, with the
+ * bad character and good suffix rules, and Horspool's simpler version.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: this follows Gusfield's book closely, so the tables here are
+// indexed from 1 like in the book, and P[i - 1] is the letter he calls
+// P(i). The pattern is compared to the text from right to left, and
+// after a mismatch (or a match) the pattern moves right by the larger
+// of the shifts given by two rules:
+//
+// 1. Bad character: the letter of the text that did not match is
+//    lined up with the rightmost copy of it in P.
+//
+// 2. Good suffix: the part of the text that did match, a suffix of P,
+//    is lined up with the rightmost other copy of it in P (L'), or if
+//    there is none, with the longest prefix of P that is a suffix of
+//    it (l').
+//
+// Both tables for the good suffix rule come from N_j, the length of
+// the longest suffix of P[1..j] that is also a suffix of P. These are
+// the Z values of P reversed, read backwards, and the Z values are
+// found in linear time with the Z-algorithm (see z_algorithm.hpp).
+//
+// Horspool's version has only one rule: after each attempt, shift so
+// the last letter of the window in the text lines up with its
+// rightmost copy in P[1..n-1]. For DNA, with its 4 letters, that copy
+// is nearly always within a few letters of the end, so the shifts are
+// short, and this is true of the bad character rule of Boyer-Moore
+// as well. So here Horspool's rule uses the last q letters of the
+// window instead of the last one, with q chosen so that there are
+// more possible q-grams than positions in P. Then most q-grams of the
+// text are not in P at all, and P moves past them completely. The
+// q-grams are numbers with 2 bits for each letter, and other letters
+// (e.g. N) are counted as A. That can only make a shift smaller than
+// it could be, never too big. With q = 1 this is the usual rule.
+//
+// Long patterns are where these are fast: the shifts can be almost
+// the length of the pattern, so most of the text is never looked at.
+// The text is given as one piece of memory (see fasta_window.hpp for
+// how the FASTA text is split up), and upper and lower case letters
+// of the text are the same, so the pattern must be in upper case.
+
+#ifndef BOYER_MOORE_HPP
+#define BOYER_MOORE_HPP
+
+#include "fasta_records.hpp"
+#include "z_algorithm.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+
+class boyer_moore {
+public:
+  explicit boyer_moore(const std::string &P);
+  size_t size() const {return n;}
+
+  // report(i) for each position i where P occurs in T[0..m-1], in order
+  template<class Report> void
+  search(const char *T, const size_t m, Report report) const;
+
+private:
+  std::string P;
+  size_t n;
+  size_t R[256];              // rightmost position of each letter in P
+  std::vector<size_t> L_big;  // L'(i), for i in 1..n+1
+  std::vector<size_t> l_small; // l'(i), for i in 1..n+1
+};
+
+
+inline
+boyer_moore::boyer_moore(const std::string &p) : P(p), n(p.length()) {
+  std::fill(R, R + 256, 0);
+  for (size_t i = 1; i <= n; ++i) {
+    R[static_cast<unsigned char>(P[i - 1])] = i;
+    R[static_cast<unsigned char>(std::tolower(P[i - 1]))] = i;
+  }
+
+  // N[j] for j in 1..n, from the Z values of the reversed pattern
+  std::string P_rev(P.rbegin(), P.rend());
+  std::vector<size_t> Z;
+  z_values(P_rev, Z);
+  std::vector<size_t> N(n + 1, 0);
+  for (size_t j = 1; j <= n; ++j)
+    N[j] = Z[n - j];
+
+  // L'(i) is the largest j < n with N_j = n - i + 1; an N_j of 0 sets
+  // L'(n + 1), which is never used
+  L_big.assign(n + 2, 0);
+  for (size_t j = 1; j < n; ++j)
+    L_big[n - N[j] + 1] = j;
+
+  // l'(i) is the largest j <= n - i + 1 with N_j = j
+  l_small.assign(n + 2, 0);
+  for (size_t i = n; i >= 1; --i) {
+    const size_t j = n - i + 1;
+    l_small[i] = (N[j] == j) ? j : l_small[i + 1];
+  }
+}
+
+
+template<class Report> void
+boyer_moore::search(const char *T, const size_t m, Report report) const {
+  if (n == 0) return;
+  // k is where the right end of P is in T, counting from 1
+  size_t k = n;
+  while (k <= m) {
+    size_t i = n, h = k;
+    while (i > 0 && P[i - 1] == fasta_upper(T[h - 1])) {
+      --i;
+      --h;
+    }
+    if (i == 0) {
+      report(k - n);
+      k += n - l_small[2];
+    }
+    else {
+      // mismatch at P(i), with the suffix P[i+1..n] matched
+      const size_t r = R[static_cast<unsigned char>(T[h - 1])];
+      const size_t bad_char = (i > r) ? i - r : 1;
+      const size_t good_suffix = (i == n) ? 1 :
+        n - (L_big[i + 1] > 0 ? L_big[i + 1] : l_small[i + 1]);
+      k += std::max(bad_char, good_suffix);
+    }
+  }
+}
+
+
+class horspool {
+public:
+  explicit horspool(const std::string &P);
+  size_t size() const {return P.length();}
+
+  template<class Report> void
+  search(const char *T, const size_t m, Report report) const;
+
+private:
+  // letters as 2 bits, with anything not A, C, G or T the same as A
+  static size_t code(const char c) {
+    switch (c) {
+    case 'C': case 'c': return 1;
+    case 'G': case 'g': return 2;
+    case 'T': case 't': return 3;
+    default: return 0;
+    }
+  }
+  size_t gram(const char *p) const {
+    size_t g = 0;
+    for (size_t i = 0; i < q; ++i)
+      g = (g << 2) | code(p[i]);
+    return g;
+  }
+
+  std::string P;
+  size_t q;
+  std::vector<size_t> shift; // for each q-gram
+};
+
+
+inline
+horspool::horspool(const std::string &p) : P(p), q(1) {
+  const size_t n = P.length();
+  // the smallest q with 4^q >= 2n, so most q-grams are not in P
+  while (q < 8 && q < n && (size_t(1) << 2*q) < 2*n) ++q;
+
+  // a q-gram not in P[0..n-2] lets P move past it completely
+  shift.assign(size_t(1) << 2*q, n - q + 1);
+  for (size_t i = 0; i + q < n; ++i)
+    shift[gram(P.data() + i)] = n - q - i;
+}
+
+
+template<class Report> void
+horspool::search(const char *T, const size_t m, Report report) const {
+  const size_t n = P.length();
+  if (n == 0) return;
+  for (size_t i = 0; i + n <= m;) {
+    if (fasta_upper(T[i + n - 1]) == P[n - 1]) {
+      size_t j = 0;
+      while (j + 1 < n && P[j] == fasta_upper(T[i + j])) ++j;
+      if (j + 1 >= n)
+        report(i);
+    }
+    i += shift[gram(T + i + n - q)];
+  }
+}
+
+#endif
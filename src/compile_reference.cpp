@@ -0,0 +1,111 @@
+/* compile_reference: pack the sequences of a FASTA file into 2 bits
+ * per base once, and save them in a binary file that the search
+ * programs can map directly the next time.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Author: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// Parsing the FASTA file for the human genome takes longer than many
+// of the searches we do on it. This program does the parsing once:
+//
+// $ ./compile_reference hg38.fa
+//
+// writes "hg38.fa.pdna" (see genome_cache.hpp for what is in it), and
+// after that kmp_fasta, rabin-karp and skew_algorithm use the cache
+// whenever they are given "hg38.fa", as long as hg38.fa has the same
+// size and modification time as when the cache was made. With "-c" an
+// existing cache is checked instead: its checksum, and whether it is
+// still up to date.
+
+#include "fasta_mmap.hpp"
+#include "packed_dna.hpp"
+#include "genome_cache.hpp"
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include <getopt.h>
+
+using std::string;
+using std::cout;
+using std::endl;
+
+
+static void
+print_usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [-c] <fasta-file> [cache-file]"
+            << std::endl
+            << "options:" << std::endl
+            << "  -c   check an existing cache instead of making one"
+            << std::endl
+            << "(the default cache-file is <fasta-file>.pdna)" << std::endl;
+}
+
+
+int
+main(int argc, char * const argv[]) {
+
+  bool check = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "c")) != -1) {
+    if (opt == 'c')
+      check = true;
+    else {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind < 1 || argc - optind > 2) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const string filename(argv[optind]);
+    const string cache_filename = (argc - optind == 2) ?
+      string(argv[optind + 1]) : genome_cache_name(filename);
+
+    if (check) {
+      const genome_cache C(cache_filename);
+      const bool checksum_ok = C.checksum_ok();
+      const bool fresh =
+        genome_cache_check(cache_filename, filename) == genome_cache_fresh;
+      cout << "bases:\t" << C.header().n_bases << endl
+           << "sequences:\t" << C.header().n_records << endl
+           << "runs:\t" << C.header().n_runs << endl
+           << "checksum:\t" << (checksum_ok ? "ok" : "BAD") << endl
+           << "up to date:\t" << (fresh ? "yes" : "no") << endl;
+      return (checksum_ok && fresh) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // the scope makes sure the file is unmapped once it is packed
+    packed_dna T;
+    {
+      const fasta_mmap fm(filename);
+      T = packed_dna(fm);
+    }
+    write_genome_cache(cache_filename, filename, T);
+    cout << "bases:\t" << T.size() << endl
+         << "sequences:\t" << T.records().size() << endl
+         << "runs:\t" << T.runs().size() << endl;
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/* fasta_index: an index of a FASTA file, in the ".fai" format of
+ * samtools, used to load only some sequences, or parts of them.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: the index of "genome.fa" is "genome.fa.fai", with one line for
+// each sequence:
+//
+//   name  length  offset  line_bases  line_width
+//
+// where "offset" is the byte in the file of the first base, and every
+// line of the sequence has "line_bases" bases and takes "line_width"
+// bytes with its end of line, except maybe the last line. So the byte
+// holding base k of a sequence is found with arithmetic:
+//
+//   offset + (k/line_bases)*line_width + k % line_bases
+//
+// and a region can be read with a single "pread" of exactly the bytes
+// it covers. This is the same file "samtools faidx" makes, so either
+// program can make it for the other. If there is no index, or it is
+// older than the FASTA file, it is made here and saved if possible.
+//
+// A compressed file can't be read at an offset without decompressing
+// everything before it, so regions need an uncompressed FASTA file.
+
+#ifndef FASTA_INDEX_HPP
+#define FASTA_INDEX_HPP
+
+#include "fasta_records.hpp"
+#include "fasta_input.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct fasta_index_entry {
+  std::string name;
+  size_t length;
+  size_t offset;
+  size_t line_bases;
+  size_t line_width;
+};
+
+
+// A part of a named sequence: bases [start, end) counting from 0. When
+// written it is "name:start-end" counting from 1 and including "end",
+// as in samtools.
+struct fasta_region {
+  std::string name;
+  size_t start;
+  size_t end;
+};
+
+
+// add the names in a list like "chr1,chr2,chrX" to "names"
+static inline void
+split_fasta_names(const std::string &list, std::vector<std::string> &names) {
+  std::istringstream iss(list);
+  std::string name;
+  while (getline(iss, name, ','))
+    if (!name.empty())
+      names.push_back(name);
+}
+
+
+class fasta_index {
+public:
+  // load "<fasta-file>.fai", or make it if it is missing or old
+  explicit fasta_index(const std::string &fasta_filename);
+
+  const std::vector<fasta_index_entry> &entries() const {return idx;}
+
+  // throws if there is no sequence with this name
+  const fasta_index_entry &find(const std::string &name) const;
+
+  // Parse "name", "name:start" or "name:start-end" (commas allowed in
+  // the numbers), checking the sequence exists and clipping the end
+  // to its length.
+  fasta_region parse_region(const std::string &s) const;
+  std::vector<fasta_region>
+  parse_regions(const std::vector<std::string> &s) const {
+    std::vector<fasta_region> r;
+    for (size_t i = 0; i < s.size(); ++i)
+      r.push_back(parse_region(s[i]));
+    return r;
+  }
+
+private:
+  void build();
+  bool load();
+  void save() const;
+
+  std::string filename;
+  std::vector<fasta_index_entry> idx;
+};
+
+
+// A region is read with "pread" at the offset of its bases in the
+// file, so the file must not be compressed. This is checked from the
+// first bytes, before any index is used, as a ".fai" made by samtools
+// for a bgzip file would otherwise give the offsets in the text, and
+// the compressed bytes there would be read as if they were bases.
+inline
+fasta_index::fasta_index(const std::string &fn) : filename(fn) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("problem with file: " + filename);
+  unsigned char magic[2];
+  const ssize_t r = pread(fd, magic, sizeof(magic), 0);
+  close(fd);
+  if (r == sizeof(magic) && fasta_input::is_gzip(magic, sizeof(magic)))
+    throw std::runtime_error("can't read regions of a compressed file: " +
+                             filename);
+  if (!load()) {
+    build();
+    save();
+  }
+}
+
+
+inline const fasta_index_entry &
+fasta_index::find(const std::string &name) const {
+  for (size_t i = 0; i < idx.size(); ++i)
+    if (idx[i].name == name)
+      return idx[i];
+  throw std::runtime_error("no sequence named " + name + " in " + filename);
+}
+
+
+inline fasta_region
+fasta_index::parse_region(const std::string &s) const {
+  // a name could have a ':' in it, so a whole name wins
+  for (size_t i = 0; i < idx.size(); ++i)
+    if (idx[i].name == s) {
+      const fasta_region r = {s, 0, idx[i].length};
+      return r;
+    }
+
+  const size_t colon = s.rfind(':');
+  if (colon == std::string::npos)
+    throw std::runtime_error("no sequence named " + s + " in " + filename);
+  const fasta_index_entry &e = find(s.substr(0, colon));
+
+  std::string range;
+  for (size_t i = colon + 1; i < s.size(); ++i)
+    if (s[i] != ',') range += s[i];
+  const size_t dash = range.find('-');
+  char *end = nullptr;
+  const size_t first = std::strtoul(range.c_str(), &end, 10);
+  size_t last = e.length;
+  if (dash != std::string::npos && dash + 1 < range.size())
+    last = std::strtoul(range.c_str() + dash + 1, nullptr, 10);
+  if (first == 0 || last < first || end == range.c_str())
+    throw std::runtime_error("bad region: " + s);
+
+  const fasta_region r = {e.name, std::min(first - 1, e.length),
+                          std::min(last, e.length)};
+  return r;
+}
+
+
+// the index is used only if it is at least as new as the FASTA file
+inline bool
+fasta_index::load() {
+  const std::string fai = filename + ".fai";
+  struct stat fa_st, fai_st;
+  if (stat(filename.c_str(), &fa_st) != 0)
+    throw std::runtime_error("problem with file: " + filename);
+  if (stat(fai.c_str(), &fai_st) != 0 || fai_st.st_mtime < fa_st.st_mtime)
+    return false;
+
+  std::ifstream in(fai);
+  std::string line;
+  while (getline(in, line)) {
+    std::istringstream iss(line);
+    fasta_index_entry e;
+    if (!getline(iss, e.name, '\t') ||
+        !(iss >> e.length >> e.offset >> e.line_bases >> e.line_width))
+      return false;
+    idx.push_back(e);
+  }
+  return true;
+}
+
+
+// Go through the file once, like fasta_mmap does, checking that the
+// lines of each sequence all have the same width except the last.
+inline void
+fasta_index::build() {
+  idx.clear();
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("problem with file: " + filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("problem with file: " + filename);
+  }
+  const size_t filesize = st.st_size;
+  if (filesize == 0) {
+    close(fd);
+    return;
+  }
+  void *m = mmap(nullptr, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    throw std::runtime_error("problem with file: " + filename);
+  const char *data = static_cast<const char *>(m);
+
+  if (fasta_input::is_gzip(reinterpret_cast<const unsigned char *>(data),
+                           filesize)) {
+    munmap(m, filesize);
+    throw std::runtime_error("can't index a compressed file: " + filename);
+  }
+
+  bool short_line = false; // a line shorter than the first was seen
+  size_t pos = 0;
+  while (pos < filesize) {
+    const char *line = data + pos;
+    const char *eol =
+      static_cast<const char *>(std::memchr(line, '\n', filesize - pos));
+    const size_t next = (eol == nullptr) ? filesize : (eol - data) + 1;
+    if (eol == nullptr) eol = data + filesize;
+    size_t len = eol - line;
+    if (len > 0 && line[len - 1] == '\r') --len;
+
+    if (len > 0 && line[0] == '>') {
+      const fasta_index_entry e = {
+        std::string(line + 1, fasta_name_length(line + 1, len - 1)),
+        0, next, 0, 0
+      };
+      idx.push_back(e);
+      short_line = false;
+    }
+    else if (!idx.empty()) {
+      fasta_index_entry &e = idx.back();
+      if (e.line_bases == 0 && e.length == 0) {
+        e.line_bases = len;
+        e.line_width = next - pos;
+      }
+      else if (len > 0 && (short_line || len > e.line_bases ||
+                           next - pos > e.line_width)) {
+        munmap(m, filesize);
+        throw std::runtime_error("lines of different widths in " + e.name +
+                                 ", so " + filename + " can't be indexed");
+      }
+      if (len < e.line_bases) short_line = true;
+      e.length += len;
+    }
+    pos = next;
+  }
+  munmap(m, filesize);
+}
+
+
+// failing to save is not an error: the index is just made again
+inline void
+fasta_index::save() const {
+  std::ofstream out(filename + ".fai");
+  for (size_t i = 0; i < idx.size() && out; ++i)
+    out << idx[i].name << '\t' << idx[i].length << '\t' << idx[i].offset
+        << '\t' << idx[i].line_bases << '\t' << idx[i].line_width << '\n';
+}
+
+
+// The text made of some regions of a FASTA file, with a separator
+// between regions, as if each region were a sequence in a FASTA file.
+// Only the bytes of the regions are read. It has the same functions
+// as fasta_mmap, so the same search kernels work on it, and the record
+// for each region has the position where the region starts in its
+// sequence, so matches can be given in the coordinates of the sequence.
+class fasta_subset {
+public:
+  fasta_subset(const std::string &filename, const fasta_index &index,
+               const std::vector<fasta_region> &regions);
+
+  size_t size() const {return text.size();}
+  char operator[](const size_t i) const {return text[i];}
+  const std::vector<fasta_record> &records() const {return seq_records;}
+  size_t locate(const size_t pos) const {return fasta_locate(seq_records, pos);}
+
+  // the text is in memory, so it is one line
+  template<class F> void for_each_line(F f) const {
+    if (!text.empty())
+      f(text.data(), text.size(), 0);
+  }
+
+  class cursor {
+  public:
+    cursor(const fasta_subset &fs, const size_t pos) : itr(fs.text.data() + pos) {}
+    char next() {return *itr++;}
+  private:
+    const char *itr;
+  };
+
+private:
+  std::string text;
+  std::vector<fasta_record> seq_records;
+};
+
+
+inline
+fasta_subset::fasta_subset(const std::string &filename,
+                           const fasta_index &index,
+                           const std::vector<fasta_region> &regions) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("problem with file: " + filename);
+
+  std::string buf;
+  for (size_t i = 0; i < regions.size(); ++i) {
+    const fasta_region &r = regions[i];
+    const fasta_index_entry &e = index.find(r.name);
+    if (i > 0)
+      text += fasta_separator;
+    const fasta_record rec = {r.name, text.size(), r.end - r.start, r.start};
+    seq_records.push_back(rec);
+    if (r.start >= r.end)
+      continue;
+
+    // the bytes from the first base to the last, and then the ends of
+    // lines are removed
+    const size_t first = e.offset + (r.start/e.line_bases)*e.line_width +
+      r.start % e.line_bases;
+    const size_t last = e.offset + ((r.end - 1)/e.line_bases)*e.line_width +
+      (r.end - 1) % e.line_bases;
+    buf.resize(last - first + 1);
+    size_t filled = 0;
+    while (filled < buf.size()) {
+      const ssize_t n = pread(fd, &buf[filled], buf.size() - filled,
+                              first + filled);
+      if (n <= 0) {
+        close(fd);
+        throw std::runtime_error("problem reading file: " + filename);
+      }
+      filled += n;
+    }
+    for (size_t j = 0; j < buf.size(); ++j)
+      if (buf[j] != '\n' && buf[j] != '\r')
+        text += buf[j];
+  }
+  close(fd);
+}
+
+#endif
@@ -0,0 +1,452 @@
+/* fasta_input: read the bytes of a file that may be compressed with
+ * gzip or bgzip, decompressing the blocks of a bgzip file in parallel.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: this uses zlib, so programs that include it (through
+// fasta_mmap.hpp or fasta_stream.hpp) must be linked with it:
+//
+// $ c++ -O3 -o kmp_fasta kmp_fasta.cpp -lz -pthread
+//
+// The first bytes of the input tell us what it is, not the name of
+// the file, so this also works on a pipe. There are three cases:
+//
+// 1. Not compressed: the bytes are passed through.
+//
+// 2. gzip: decompressed with zlib as we go. A gzip file is one long
+//    stream, so this can only use one thread. Files made by joining
+//    gzip files ("cat a.gz b.gz") are handled.
+//
+// 3. bgzip (BGZF, used by samtools and htslib): the file is a series
+//    of gzip blocks, each holding at most 64KB of text and saying in
+//    its header how big it is. So we can find many blocks without
+//    decompressing anything, and decompress them at the same time on
+//    different threads. We do "bgzf_batch_blocks" blocks at a time,
+//    with each thread taking the next block not yet taken, and hand
+//    out the text of a batch in order before starting the next one.
+//    The threads are started at the first batch and kept, each with
+//    its own z_stream, until the fasta_input is destroyed, so a big
+//    file does not start new threads for every batch. The thread that
+//    calls "read" decompresses blocks too, so if no threads can be
+//    started the blocks are all done on that one.
+//
+// Nothing is ever written to disk: the text only exists in memory, one
+// batch at a time (unless the caller keeps all of it, as fasta_mmap
+// does for a compressed file).
+
+#ifndef FASTA_INPUT_HPP
+#define FASTA_INPUT_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#include <unistd.h>
+#include <zlib.h>
+
+class fasta_input {
+public:
+  static const size_t bgzf_max_block = 1ul << 16; // 64KB
+  static const size_t bgzf_batch_blocks = 256;    // up to 16MB of text
+
+  // reads "fd" (which stays open); "n_threads" of 0 means one for
+  // each processor, and only matters for bgzip
+  fasta_input(const int fd, const std::string &filename,
+              const size_t n_threads = 0);
+  ~fasta_input();
+
+  fasta_input(const fasta_input &) = delete;
+  fasta_input &operator=(const fasta_input &) = delete;
+
+  // Put up to "n" bytes of text in "buf". Returns the number of bytes,
+  // which is 0 only at the end of the input.
+  size_t read(char *buf, const size_t n);
+
+  bool compressed() const {return mode != plain;}
+  bool bgzf() const {return mode == bgzf_blocks;}
+
+  // does this start like a gzip file?
+  static bool is_gzip(const unsigned char *p, const size_t n) {
+    return n >= 2 && p[0] == 0x1f && p[1] == 0x8b;
+  }
+
+private:
+  enum input_mode {plain, gzip_stream, bgzf_blocks};
+
+  size_t fill_input();
+  size_t read_plain(char *buf, const size_t n);
+  size_t read_gzip(char *buf, const size_t n);
+  bool next_bgzf_batch();
+  void start_bgzf_workers();
+  void bgzf_worker();
+  void inflate_bgzf_blocks(z_stream &s);
+
+  int fd;
+  std::string filename;
+  size_t n_threads;
+  input_mode mode;
+
+  // compressed bytes (or plain bytes read while looking at the start)
+  std::vector<unsigned char> in;
+  size_t in_pos;
+  size_t in_end;
+  bool in_eof;
+
+  // for gzip
+  z_stream zs;
+  bool zs_ready;
+  bool member_done;
+
+  // for bgzip: the text of the current batch
+  std::vector<char> out;
+  size_t out_pos;
+  size_t out_end;
+
+  // for bgzip: the blocks of the current batch, and where their text
+  // goes in "out"
+  std::vector<size_t> starts;
+  std::vector<size_t> sizes;
+  std::vector<size_t> text_offsets;
+  std::atomic<size_t> next_block;
+  std::atomic<bool> failed;
+
+  // for bgzip: the threads that help decompress each batch. A new
+  // batch is given to them by adding 1 to "batch", and "n_busy" is the
+  // number of them still working on it.
+  std::vector<std::thread> workers;
+  bool workers_started;
+  std::mutex mtx;
+  std::condition_variable batch_ready;
+  std::condition_variable batch_done;
+  size_t batch;
+  size_t n_busy;
+  bool stop;
+  z_stream bgzf_zs; // for the thread that calls "read"
+  bool bgzf_zs_ready;
+};
+
+
+// Size of the BGZF block starting at p, or 0 if there is not a full
+// BGZF header in the n bytes at p.
+static inline size_t
+bgzf_block_size(const unsigned char *p, const size_t n) {
+  // gzip magic, "deflate", FLG.FEXTRA, then XLEN after 10 bytes
+  if (n < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4))
+    return 0;
+  const size_t xlen = p[10] | (p[11] << 8);
+  if (n < 12 + xlen) return 0;
+  // the extra field has subfields; BGZF has one named "BC"
+  for (size_t i = 12; i + 4 <= 12 + xlen;) {
+    const size_t slen = p[i + 2] | (p[i + 3] << 8);
+    if (p[i] == 'B' && p[i + 1] == 'C' && slen == 2 && i + 6 <= 12 + xlen)
+      return (p[i + 4] | (p[i + 5] << 8)) + 1;
+    i += 4 + slen;
+  }
+  return 0;
+}
+
+
+static inline uint32_t
+bgzf_read_u32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+
+inline
+fasta_input::fasta_input(const int fd, const std::string &fn,
+                         const size_t n_thr) :
+  fd(fd), filename(fn), n_threads(n_thr), mode(plain),
+  in(bgzf_max_block), in_pos(0), in_end(0),
+  in_eof(false), zs_ready(false), member_done(false), out_pos(0), out_end(0),
+  next_block(0), failed(false), workers_started(false), batch(0), n_busy(0),
+  stop(false), bgzf_zs_ready(false) {
+
+  if (n_threads == 0)
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  // enough of the start to see what kind of file this is
+  while (!in_eof && in_end < 18) {
+    const ssize_t r = ::read(fd, in.data() + in_end, in.size() - in_end);
+    if (r == 0) in_eof = true;
+    else if (r > 0) in_end += r;
+    else if (errno != EINTR)
+      throw std::runtime_error("problem reading file: " + filename);
+  }
+
+  if (bgzf_block_size(in.data(), in_end) > 0)
+    mode = bgzf_blocks;
+  else if (is_gzip(in.data(), in_end)) {
+    mode = gzip_stream;
+    std::memset(&zs, 0, sizeof(zs));
+    // 15 + 32: the largest window, and expect a gzip header
+    if (inflateInit2(&zs, 15 + 32) != Z_OK)
+      throw std::runtime_error("problem decompressing file: " + filename);
+    zs_ready = true;
+  }
+  // room for a whole batch of blocks plus part of the next one
+  if (mode != plain)
+    in.resize((bgzf_batch_blocks + 1)*bgzf_max_block);
+}
+
+
+inline
+fasta_input::~fasta_input() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stop = true;
+  }
+  batch_ready.notify_all();
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  if (zs_ready)
+    inflateEnd(&zs);
+  if (bgzf_zs_ready)
+    inflateEnd(&bgzf_zs);
+}
+
+
+// read more bytes after those we have, moving the unused ones to the
+// front first; returns the number of bytes read
+inline size_t
+fasta_input::fill_input() {
+  if (in_pos > 0) {
+    std::memmove(in.data(), in.data() + in_pos, in_end - in_pos);
+    in_end -= in_pos;
+    in_pos = 0;
+  }
+  size_t filled = 0;
+  while (!in_eof && in_end < in.size()) {
+    const ssize_t r = ::read(fd, in.data() + in_end, in.size() - in_end);
+    if (r == 0) in_eof = true;
+    else if (r < 0) {
+      if (errno == EINTR) continue;
+      throw std::runtime_error("problem reading file: " + filename);
+    }
+    else {
+      in_end += r;
+      filled += r;
+    }
+  }
+  return filled;
+}
+
+
+inline size_t
+fasta_input::read(char *buf, const size_t n) {
+  if (mode == plain) return read_plain(buf, n);
+  if (mode == gzip_stream) return read_gzip(buf, n);
+
+  if (out_pos == out_end && !next_bgzf_batch())
+    return 0;
+  const size_t k = std::min(n, out_end - out_pos);
+  std::memcpy(buf, out.data() + out_pos, k);
+  out_pos += k;
+  return k;
+}
+
+
+inline size_t
+fasta_input::read_plain(char *buf, const size_t n) {
+  // first whatever was read to look at the start of the file
+  if (in_pos < in_end) {
+    const size_t k = std::min(n, in_end - in_pos);
+    std::memcpy(buf, in.data() + in_pos, k);
+    in_pos += k;
+    return k;
+  }
+  while (!in_eof) {
+    const ssize_t r = ::read(fd, buf, n);
+    if (r > 0) return r;
+    if (r == 0) in_eof = true;
+    else if (errno != EINTR)
+      throw std::runtime_error("problem reading file: " + filename);
+  }
+  return 0;
+}
+
+
+inline size_t
+fasta_input::read_gzip(char *buf, const size_t n) {
+  zs.next_out = reinterpret_cast<Bytef *>(buf);
+  zs.avail_out = n;
+  while (zs.avail_out > 0) {
+    if (in_pos == in_end) {
+      fill_input();
+      if (in_pos == in_end) {
+        if (!member_done)
+          throw std::runtime_error("truncated gzip file: " + filename);
+        break;
+      }
+    }
+    if (member_done) {
+      // another gzip member follows the one that ended
+      inflateReset(&zs);
+      member_done = false;
+    }
+    zs.next_in = in.data() + in_pos;
+    zs.avail_in = in_end - in_pos;
+    const int ret = inflate(&zs, Z_NO_FLUSH);
+    in_pos = in_end - zs.avail_in;
+    if (ret == Z_STREAM_END)
+      member_done = true;
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+      throw std::runtime_error("problem decompressing file: " + filename);
+  }
+  return n - zs.avail_out;
+}
+
+
+// Decompress blocks of the current batch with "s", taking the next
+// one not yet taken until there are none left
+inline void
+fasta_input::inflate_bgzf_blocks(z_stream &s) {
+  size_t i = 0;
+  while (!failed && (i = next_block++) < starts.size()) {
+    const unsigned char *b = in.data() + starts[i];
+    const size_t header = 12 + (b[10] | (b[11] << 8));
+    const size_t text_size = text_offsets[i + 1] - text_offsets[i];
+    Bytef *dst = reinterpret_cast<Bytef *>(out.data() + text_offsets[i]);
+    inflateReset(&s);
+    s.next_in = const_cast<Bytef *>(b + header);
+    s.avail_in = sizes[i] - header - 8;
+    s.next_out = dst;
+    s.avail_out = text_size;
+    if (inflate(&s, Z_FINISH) != Z_STREAM_END || s.avail_out != 0 ||
+        crc32(0, dst, text_size) !=
+        bgzf_read_u32(b + sizes[i] - 8))
+      failed = true;
+  }
+}
+
+
+// A thread that helps with each batch until the fasta_input is
+// destroyed
+inline void
+fasta_input::bgzf_worker() {
+  z_stream s;
+  std::memset(&s, 0, sizeof(s));
+  // negative window bits: raw deflate data, as the gzip header and
+  // trailer of each block are handled here
+  const bool ready = inflateInit2(&s, -15) == Z_OK;
+  size_t done = 0; // the last batch this thread worked on
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      batch_ready.wait(lock, [&]() {return batch != done || stop;});
+      if (stop) break;
+      done = batch;
+    }
+    if (ready)
+      inflate_bgzf_blocks(s);
+    else
+      failed = true;
+    bool last = false;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      last = (--n_busy == 0);
+    }
+    if (last)
+      batch_done.notify_one();
+  }
+  if (ready)
+    inflateEnd(&s);
+}
+
+
+// Start the threads that help the calling thread, as many as can be
+// started up to n_threads - 1
+inline void
+fasta_input::start_bgzf_workers() {
+  workers_started = true;
+  std::memset(&bgzf_zs, 0, sizeof(bgzf_zs));
+  if (inflateInit2(&bgzf_zs, -15) != Z_OK)
+    throw std::runtime_error("problem decompressing file: " + filename);
+  bgzf_zs_ready = true;
+  try {
+    for (size_t t = 1; t < n_threads; ++t)
+      workers.push_back(std::thread(&fasta_input::bgzf_worker, this));
+  }
+  catch (std::system_error &) {}
+}
+
+
+// Decompress the next batch of BGZF blocks into "out"; returns false
+// at the end of the input.
+inline bool
+fasta_input::next_bgzf_batch() {
+  starts.clear();
+  sizes.clear();
+  text_offsets.assign(1, 0);
+  for (;;) {
+    // find the complete blocks we have, reading more when needed
+    fill_input();
+    size_t p = in_pos;
+    while (starts.size() < bgzf_batch_blocks) {
+      const size_t bsize = bgzf_block_size(in.data() + p, in_end - p);
+      if (bsize == 0 || bsize < 26 || p + bsize > in_end) break;
+      starts.push_back(p);
+      sizes.push_back(bsize);
+      // the last 4 bytes of a block are the size of its text
+      text_offsets.push_back(text_offsets.back() +
+                             bgzf_read_u32(in.data() + p + bsize - 4));
+      p += bsize;
+    }
+    if (!starts.empty() || (in_eof && p == in_end)) {
+      if (starts.empty()) return false;
+      break;
+    }
+    if (in_eof || in_end - in_pos >= in.size())
+      throw std::runtime_error("not a complete bgzip file: " + filename);
+  }
+
+  out.resize(std::max(out.size(), text_offsets.back()));
+
+  if (!workers_started)
+    start_bgzf_workers();
+
+  next_block = 0;
+  failed = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    ++batch;
+    n_busy = workers.size();
+  }
+  batch_ready.notify_all();
+  inflate_bgzf_blocks(bgzf_zs);
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    batch_done.wait(lock, [&]() {return n_busy == 0;});
+  }
+  if (failed)
+    throw std::runtime_error("problem decompressing file: " + filename);
+
+  in_pos = starts.back() + sizes.back();
+  out_pos = 0;
+  out_end = text_offsets.back();
+  // a batch may be all empty blocks (e.g. the one at the end)
+  return out_end > 0 || next_bgzf_batch();
+}
+
+#endif
@@ -0,0 +1,363 @@
+/* fasta_mmap: read-only memory map of a FASTA format file, with a
+ * table of the sequence lines so the bases can be visited in place
+ * instead of being copied out of the file.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: everything here is in the header so each program can still be
+// compiled from a single source file, e.g.:
+//
+// $ c++ -O3 -o kmp_fasta kmp_fasta.cpp -lz -pthread
+//
+// The idea: the operating system already keeps the file in the page
+// cache, so if we map it we can read the bases right where they are,
+// and several programs running on the same file share those pages.
+// The only thing we need to build is a table telling us where the
+// sequence lines are. Since FASTA files nearly always have the same
+// number of bases on every line, we store "blocks" of consecutive
+// lines having the same width, which means the table stays tiny even
+// for the human genome (a few entries per chromosome). The names of
+// the sequences are kept in a separate table (see fasta_records.hpp),
+// and one separator is placed between sequences in the text.
+//
+// A file compressed with gzip or bgzip can't be mapped, so instead it
+// is decompressed into memory (see fasta_input.hpp) and the table is
+// built over that memory. Nothing else here needs to know.
+
+#ifndef FASTA_MMAP_HPP
+#define FASTA_MMAP_HPP
+
+#include "fasta_records.hpp"
+#include "fasta_input.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+
+// these are for mapping the file and are available in unix/linux/macos
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A run of consecutive sequence lines that each have "line_len" bases
+// and start "stride" bytes apart in the file (stride includes the
+// end-of-line characters).
+struct fasta_line_block {
+  size_t file_offset; // byte offset of the first line in the file
+  size_t seq_offset;  // position of the first base of the block
+  size_t line_len;
+  size_t stride;
+  size_t n_lines;
+};
+
+
+class fasta_mmap {
+public:
+  explicit fasta_mmap(const std::string &filename);
+  ~fasta_mmap();
+
+  // it owns the mapping, so no copies
+  fasta_mmap(const fasta_mmap &) = delete;
+  fasta_mmap &operator=(const fasta_mmap &) = delete;
+
+  // length of the text: the bases plus the separators
+  size_t size() const {return n_bases;}
+
+  // random access costs a binary search over the blocks, so this
+  // should not be used inside of any loop over the whole text
+  char operator[](const size_t pos) const;
+
+  // Visit each sequence line in order: f(line, len, pos) where "pos"
+  // is the position in the text of line[0]. This is how the search
+  // kernels should scan the text, carrying their state across lines.
+  // Each separator between sequences is visited as a line of length 1.
+  template<class F> void for_each_line(F f) const;
+
+  // A cursor moves forward one base at a time, jumping over the
+  // ends of lines and the name lines
+  class cursor {
+  public:
+    cursor(const fasta_mmap &fm, const size_t pos);
+    char next() {
+      if (line_itr == line_end) next_line();
+      return *line_itr++;
+    }
+  private:
+    void next_line();
+    const fasta_mmap *fm;
+    size_t block;
+    size_t line;
+    size_t n_seps;  // separators to give before the line is started
+    bool fresh;     // the line at (block, line) is not started
+    const char *line_itr;
+    const char *line_end;
+  };
+
+  const std::vector<fasta_line_block> &blocks() const {return line_blocks;}
+  const std::vector<fasta_record> &records() const {return seq_records;}
+
+  // the sequence (index into records) containing a position
+  size_t locate(const size_t pos) const {return fasta_locate(seq_records, pos);}
+
+private:
+  void build_line_blocks();
+  const char *line_start(const size_t b, const size_t line) const {
+    return data + line_blocks[b].file_offset + line*line_blocks[b].stride;
+  }
+  size_t block_end(const size_t b) const {
+    return line_blocks[b].seq_offset +
+      line_blocks[b].n_lines*line_blocks[b].line_len;
+  }
+  // the first block that starts after "pos"
+  size_t block_after(const size_t pos) const {
+    return std::upper_bound(begin(line_blocks), end(line_blocks), pos,
+                            [](const size_t p, const fasta_line_block &x) {
+                              return p < x.seq_offset;
+                            }) - begin(line_blocks);
+  }
+
+  std::string filename;
+  const char *data;
+  size_t filesize;
+  char *inflated; // the text of a compressed file
+  size_t n_bases;
+  std::vector<fasta_line_block> line_blocks;
+  std::vector<fasta_record> seq_records;
+};
+
+
+inline
+fasta_mmap::fasta_mmap(const std::string &fn) :
+  filename(fn), data(nullptr), filesize(0), inflated(nullptr), n_bases(0) {
+
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("problem with file: " + filename);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("problem with file: " + filename);
+  }
+  filesize = st.st_size;
+
+  unsigned char magic[2];
+  if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+      fasta_input::is_gzip(magic, sizeof(magic))) {
+    try {
+      fasta_input in(fd, filename);
+      // Guess the text is 4 times the compressed size, then grow. This
+      // uses malloc because the memory not used is never touched,
+      // and realloc of a big block can avoid copying it.
+      size_t capacity = 4*filesize + fasta_input::bgzf_max_block;
+      size_t filled = 0, r = 0;
+      inflated = static_cast<char *>(std::malloc(capacity));
+      while (inflated != nullptr &&
+             (r = in.read(inflated + filled, capacity - filled)) > 0)
+        if ((filled += r) == capacity) {
+          capacity *= 2;
+          char *p = static_cast<char *>(std::realloc(inflated, capacity));
+          if (p == nullptr) std::free(inflated);
+          inflated = p;
+        }
+      if (inflated == nullptr)
+        throw std::runtime_error("out of memory for file: " + filename);
+      filesize = filled;
+    }
+    catch (...) {
+      std::free(inflated);
+      close(fd);
+      throw;
+    }
+    close(fd);
+    data = inflated;
+    build_line_blocks();
+    return;
+  }
+
+  // mmap refuses a length of 0, and there is nothing to read anyway
+  if (filesize > 0) {
+    void *m = mmap(nullptr, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("problem with file: " + filename);
+    }
+    data = static_cast<const char *>(m);
+#ifdef MADV_SEQUENTIAL
+    // the file is read from start to end, both to find the lines and
+    // then by the search, so the kernel can read far ahead of us
+    madvise(m, filesize, MADV_SEQUENTIAL);
+#endif
+  }
+  // the mapping stays valid after the file descriptor is closed
+  close(fd);
+
+  build_line_blocks();
+}
+
+
+inline
+fasta_mmap::~fasta_mmap() {
+  if (inflated != nullptr)
+    std::free(inflated);
+  else if (data != nullptr)
+    munmap(const_cast<char *>(data), filesize);
+}
+
+
+inline void
+fasta_mmap::build_line_blocks() {
+  // this is the only pass over the file that is not done by a search
+  // kernel; it finds the line ends with "memchr", which is very fast
+  size_t pos = 0;
+  while (pos < filesize) {
+    const char *line = data + pos;
+    const char *eol =
+      static_cast<const char *>(std::memchr(line, '\n', filesize - pos));
+    const size_t next = (eol == nullptr) ? filesize : (eol - data) + 1;
+    if (eol == nullptr) eol = data + filesize;
+
+    size_t len = eol - line;
+    if (len > 0 && line[len - 1] == '\r') --len; // DOS line ends
+
+    if (len > 0 && line[0] == '>') {
+      // a new sequence: finish the previous one and leave room for
+      // the separator that goes between them
+      if (!seq_records.empty()) {
+        seq_records.back().length = n_bases - seq_records.back().offset;
+        ++n_bases;
+      }
+      const fasta_record r = {
+        std::string(line + 1, fasta_name_length(line + 1, len - 1)),
+        n_bases, 0, 0
+      };
+      seq_records.push_back(r);
+    }
+    else if (len > 0) { // skip empty lines
+      // sequence before any name line gets an empty name
+      if (seq_records.empty()) {
+        const fasta_record r = {std::string(), 0, 0, 0};
+        seq_records.push_back(r);
+      }
+      const size_t stride = next - pos;
+      if (!line_blocks.empty()) {
+        fasta_line_block &b = line_blocks.back();
+        if (b.line_len == len && b.stride == stride &&
+            b.file_offset + b.n_lines*b.stride == pos &&
+            b.seq_offset + b.n_lines*b.line_len == n_bases) {
+          ++b.n_lines;
+          n_bases += len;
+          pos = next;
+          continue;
+        }
+      }
+      const fasta_line_block b = {pos, n_bases, len, stride, 1};
+      line_blocks.push_back(b);
+      n_bases += len;
+    }
+    pos = next;
+  }
+  if (!seq_records.empty())
+    seq_records.back().length = n_bases - seq_records.back().offset;
+}
+
+
+inline char
+fasta_mmap::operator[](const size_t pos) const {
+  // find the last block starting at or before "pos"
+  const size_t b = block_after(pos);
+  if (b == 0 || pos >= block_end(b - 1))
+    return fasta_separator;
+  const fasta_line_block &x = line_blocks[b - 1];
+  const size_t k = pos - x.seq_offset;
+  return data[x.file_offset + (k/x.line_len)*x.stride + k % x.line_len];
+}
+
+
+template<class F> void
+fasta_mmap::for_each_line(F f) const {
+  size_t pos = 0;
+  for (size_t b = 0; b < line_blocks.size(); ++b) {
+    const fasta_line_block &x = line_blocks[b];
+    for (; pos < x.seq_offset; ++pos)
+      f(&fasta_separator, 1, pos);
+    for (size_t i = 0; i < x.n_lines; ++i)
+      f(line_start(b, i), x.line_len, x.seq_offset + i*x.line_len);
+    pos = block_end(b);
+  }
+  // separators for any empty sequences at the end
+  for (; pos < n_bases; ++pos)
+    f(&fasta_separator, 1, pos);
+}
+
+
+inline
+fasta_mmap::cursor::cursor(const fasta_mmap &f, const size_t pos) :
+  fm(&f), block(0), line(0), n_seps(0), fresh(true),
+  line_itr(nullptr), line_end(nullptr) {
+
+  const size_t b = fm->block_after(pos);
+  if (b > 0 && pos < fm->block_end(b - 1)) {
+    // inside the lines of block b - 1
+    const fasta_line_block &x = fm->line_blocks[b - 1];
+    const size_t k = pos - x.seq_offset;
+    block = b - 1;
+    line = k/x.line_len;
+    fresh = false;
+    line_itr = fm->line_start(block, line) + k % x.line_len;
+    line_end = fm->line_start(block, line) + x.line_len;
+  }
+  else {
+    // on separators before block b (or at the end of the text)
+    block = b;
+    n_seps = (b < fm->line_blocks.size() ?
+              fm->line_blocks[b].seq_offset : fm->n_bases) - pos;
+  }
+}
+
+
+inline void
+fasta_mmap::cursor::next_line() {
+  const std::vector<fasta_line_block> &lb = fm->line_blocks;
+  if (!fresh) {
+    // finished the current line, so move to the next one and see if
+    // there are separators in between
+    const size_t end_pos = lb[block].seq_offset + (line + 1)*lb[block].line_len;
+    n_seps = 0;
+    if (++line == lb[block].n_lines) {
+      ++block;
+      line = 0;
+      n_seps = (block < lb.size() ?
+                lb[block].seq_offset : fm->n_bases) - end_pos;
+    }
+    fresh = true;
+  }
+  if (n_seps > 0) {
+    --n_seps;
+    line_itr = &fasta_separator;
+    line_end = line_itr + 1;
+    return;
+  }
+  fresh = false;
+  line_itr = fm->line_start(block, line);
+  line_end = line_itr + lb[block].line_len;
+}
+
+#endif
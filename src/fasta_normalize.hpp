@@ -0,0 +1,334 @@
+/* fasta_normalize: one pass over raw FASTA bytes that removes the
+ * ends of lines, takes out the name lines, converts to upper case
+ * and, if asked, encodes the bases as small numbers.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: reading a FASTA file is limited by how fast we can move bytes
+// through memory, so we should touch each byte only once. The work
+// is split in two: a small state machine that knows about name lines
+// and separators, and a "line kernel" that copies the bases of one
+// line, converting each one, until it finds the '\n'. The line
+// kernel handles 16, 32 or 64 bytes per step using SSE2, AVX2 or
+// AVX-512 instructions, picked when the program runs according to
+// what the CPU has. On other CPUs, or other compilers, the plain C++
+// version is used. All versions give the same output.
+//
+// The output for the separators and the records is the same as in
+// fasta_records.hpp, so the text is exactly what fasta_mmap gives,
+// only upper case (or encoded).
+//
+// The vector kernels write a full vector even when only part of it is
+// real output, so the output buffer needs "slack" bytes beyond the
+// size of the input.
+
+#ifndef FASTA_NORMALIZE_HPP
+#define FASTA_NORMALIZE_HPP
+
+#include "fasta_records.hpp"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__GNUC__) || defined(__clang__))
+#define FASTA_NORMALIZE_X86 1
+#include <immintrin.h>
+#endif
+
+// the numbers to use for each letter when encoding; lower case is
+// the same as upper, and "other" is for N, IUPAC codes and separators
+struct dna_codes {
+  char a, c, g, t, other;
+};
+
+
+// Copies (converting) bytes from [p, lim) to "out" up to the first
+// '\n', and returns the number of bytes copied, so the '\n' (if any)
+// is at p + returned value.
+typedef size_t (*fasta_line_kernel)(const char *p, const char *lim,
+                                    char *out, const char *table,
+                                    const dna_codes *codes);
+
+static inline size_t
+fasta_line_kernel_scalar(const char *p, const char *lim, char *out,
+                         const char *table, const dna_codes *) {
+  const char *const start = p;
+  while (p < lim && *p != '\n')
+    *out++ = table[static_cast<unsigned char>(*p++)];
+  return p - start;
+}
+
+
+#ifdef FASTA_NORMALIZE_X86
+
+__attribute__((target("sse2"))) static inline size_t
+fasta_line_kernel_sse2(const char *p, const char *lim, char *out,
+                       const char *table, const dna_codes *codes) {
+  const char *const start = p;
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i lo = _mm_set1_epi8('a' - 1), hi = _mm_set1_epi8('z' + 1);
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  while (lim - p >= 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    // upper case: subtract 0x20 where 'a' <= v <= 'z'
+    const __m128i is_lower =
+      _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+    __m128i u = _mm_sub_epi8(v, _mm_and_si128(is_lower, case_bit));
+    if (codes != nullptr) {
+      const __m128i eq_a = _mm_cmpeq_epi8(u, _mm_set1_epi8('A'));
+      const __m128i eq_c = _mm_cmpeq_epi8(u, _mm_set1_epi8('C'));
+      const __m128i eq_g = _mm_cmpeq_epi8(u, _mm_set1_epi8('G'));
+      const __m128i eq_t = _mm_cmpeq_epi8(u, _mm_set1_epi8('T'));
+      const __m128i any = _mm_or_si128(_mm_or_si128(eq_a, eq_c),
+                                       _mm_or_si128(eq_g, eq_t));
+      u = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(eq_a, _mm_set1_epi8(codes->a)),
+                     _mm_and_si128(eq_c, _mm_set1_epi8(codes->c))),
+        _mm_or_si128(_mm_and_si128(eq_g, _mm_set1_epi8(codes->g)),
+                     _mm_and_si128(eq_t, _mm_set1_epi8(codes->t))));
+      u = _mm_or_si128(u, _mm_andnot_si128(any, _mm_set1_epi8(codes->other)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), u);
+    const unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    if (m != 0)
+      return (p - start) + __builtin_ctz(m);
+    p += 16;
+    out += 16;
+  }
+  return (p - start) + fasta_line_kernel_scalar(p, lim, out, table, codes);
+}
+
+
+__attribute__((target("avx2"))) static inline size_t
+fasta_line_kernel_avx2(const char *p, const char *lim, char *out,
+                       const char *table, const dna_codes *codes) {
+  const char *const start = p;
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i lo = _mm256_set1_epi8('a' - 1), hi = _mm256_set1_epi8('z' + 1);
+  const __m256i case_bit = _mm256_set1_epi8(0x20);
+  while (lim - p >= 32) {
+    const __m256i v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const __m256i is_lower =
+      _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+    __m256i u = _mm256_sub_epi8(v, _mm256_and_si256(is_lower, case_bit));
+    if (codes != nullptr) {
+      const __m256i eq_a = _mm256_cmpeq_epi8(u, _mm256_set1_epi8('A'));
+      const __m256i eq_c = _mm256_cmpeq_epi8(u, _mm256_set1_epi8('C'));
+      const __m256i eq_g = _mm256_cmpeq_epi8(u, _mm256_set1_epi8('G'));
+      const __m256i eq_t = _mm256_cmpeq_epi8(u, _mm256_set1_epi8('T'));
+      const __m256i any = _mm256_or_si256(_mm256_or_si256(eq_a, eq_c),
+                                          _mm256_or_si256(eq_g, eq_t));
+      u = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(eq_a, _mm256_set1_epi8(codes->a)),
+                        _mm256_and_si256(eq_c, _mm256_set1_epi8(codes->c))),
+        _mm256_or_si256(_mm256_and_si256(eq_g, _mm256_set1_epi8(codes->g)),
+                        _mm256_and_si256(eq_t, _mm256_set1_epi8(codes->t))));
+      u = _mm256_or_si256(u, _mm256_andnot_si256(any,
+                                                 _mm256_set1_epi8(codes->other)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), u);
+    const unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    if (m != 0)
+      return (p - start) + __builtin_ctz(m);
+    p += 32;
+    out += 32;
+  }
+  return (p - start) + fasta_line_kernel_sse2(p, lim, out, table, codes);
+}
+
+
+__attribute__((target("avx512f,avx512bw"))) static inline size_t
+fasta_line_kernel_avx512(const char *p, const char *lim, char *out,
+                         const char *table, const dna_codes *codes) {
+  const char *const start = p;
+  const __m512i nl = _mm512_set1_epi8('\n');
+  const __m512i a = _mm512_set1_epi8('a'), z = _mm512_set1_epi8('z');
+  const __m512i case_bit = _mm512_set1_epi8(0x20);
+  while (lim - p >= 64) {
+    const __m512i v = _mm512_loadu_si512(p);
+    const __mmask64 is_lower =
+      _mm512_cmpge_epi8_mask(v, a) & _mm512_cmple_epi8_mask(v, z);
+    __m512i u = _mm512_mask_sub_epi8(v, is_lower, v, case_bit);
+    if (codes != nullptr) {
+      const __mmask64 eq_a = _mm512_cmpeq_epi8_mask(u, _mm512_set1_epi8('A'));
+      const __mmask64 eq_c = _mm512_cmpeq_epi8_mask(u, _mm512_set1_epi8('C'));
+      const __mmask64 eq_g = _mm512_cmpeq_epi8_mask(u, _mm512_set1_epi8('G'));
+      const __mmask64 eq_t = _mm512_cmpeq_epi8_mask(u, _mm512_set1_epi8('T'));
+      u = _mm512_set1_epi8(codes->other);
+      u = _mm512_mask_mov_epi8(u, eq_a, _mm512_set1_epi8(codes->a));
+      u = _mm512_mask_mov_epi8(u, eq_c, _mm512_set1_epi8(codes->c));
+      u = _mm512_mask_mov_epi8(u, eq_g, _mm512_set1_epi8(codes->g));
+      u = _mm512_mask_mov_epi8(u, eq_t, _mm512_set1_epi8(codes->t));
+    }
+    _mm512_storeu_si512(out, u);
+    const uint64_t m = _mm512_cmpeq_epi8_mask(v, nl);
+    if (m != 0)
+      return (p - start) + __builtin_ctzll(m);
+    p += 64;
+    out += 64;
+  }
+  return (p - start) + fasta_line_kernel_avx2(p, lim, out, table, codes);
+}
+
+#endif
+
+
+// pick the widest kernel the CPU can run
+static inline fasta_line_kernel
+fasta_select_line_kernel() {
+#ifdef FASTA_NORMALIZE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw"))
+    return fasta_line_kernel_avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return fasta_line_kernel_avx2;
+  return fasta_line_kernel_sse2;
+#else
+  return fasta_line_kernel_scalar;
+#endif
+}
+
+
+class fasta_normalizer {
+public:
+  // bytes past the output that the vector kernels may write
+  static const size_t slack = 64;
+
+  // with "codes" the bases are encoded, otherwise only upper-cased;
+  // "scalar" forces the plain C++ kernel
+  explicit fasta_normalizer(const dna_codes *codes = nullptr,
+                            const bool scalar = false);
+
+  // Normalize the next "n" bytes of the file into "out", which must
+  // have room for n + 1 + slack bytes. Returns the number of bytes
+  // written. The input can be split anywhere; the state carries over.
+  size_t normalize(const char *in, const size_t n, char *out);
+
+  // call after the last input to set the length of the last record
+  void finish() {
+    if (!seq_records.empty())
+      seq_records.back().length = n_bases - seq_records.back().offset;
+  }
+
+  // length of the text so far, and the sequences seen so far
+  size_t size() const {return n_bases;}
+  const std::vector<fasta_record> &records() const {return seq_records;}
+
+private:
+  fasta_line_kernel kernel;
+  const dna_codes *codes;
+  char table[256]; // for the scalar kernel
+  char separator;  // fasta_separator, encoded if needed
+  size_t n_bases;
+  bool at_line_start;
+  bool in_name;
+  bool name_done;
+  bool pending_cr; // the last input ended with '\r' in a sequence line
+  std::vector<fasta_record> seq_records;
+};
+
+
+inline
+fasta_normalizer::fasta_normalizer(const dna_codes *c, const bool scalar) :
+  kernel(scalar ? fasta_line_kernel_scalar : fasta_select_line_kernel()),
+  codes(c), separator(c ? c->other : fasta_separator), n_bases(0),
+  at_line_start(true), in_name(false), name_done(false), pending_cr(false) {
+  for (size_t i = 0; i < 256; ++i) {
+    const char x = fasta_upper(static_cast<char>(i));
+    if (codes == nullptr)
+      table[i] = x;
+    else
+      table[i] = (x == 'A') ? codes->a : (x == 'C') ? codes->c :
+        (x == 'G') ? codes->g : (x == 'T') ? codes->t : codes->other;
+  }
+}
+
+
+inline size_t
+fasta_normalizer::normalize(const char *p, const size_t n, char *out) {
+  const char *const lim = p + n;
+  char *const out_start = out;
+  while (p < lim) {
+    if (at_line_start) {
+      at_line_start = false;
+      if (*p == '>') {
+        // a new sequence: finish the previous one and put the
+        // separator between them
+        if (!seq_records.empty()) {
+          seq_records.back().length = n_bases - seq_records.back().offset;
+          *out++ = separator;
+          ++n_bases;
+        }
+        const fasta_record r = {std::string(), n_bases, 0, 0};
+        seq_records.push_back(r);
+        in_name = true;
+        name_done = false;
+        ++p;
+        continue;
+      }
+    }
+    if (in_name) {
+      const char *eol = static_cast<const char *>(std::memchr(p, '\n', lim - p));
+      const char *e = (eol == nullptr) ? lim : eol;
+      if (!name_done) {
+        const size_t len = fasta_name_length(p, e - p);
+        seq_records.back().name.append(p, len);
+        name_done = (p + len != e);
+      }
+      if (eol == nullptr)
+        return out - out_start;
+      in_name = false;
+      at_line_start = true;
+      p = eol + 1;
+      continue;
+    }
+
+    // a line of sequence (or the rest of one)
+    if (seq_records.empty()) {
+      const fasta_record r = {std::string(), 0, 0, 0};
+      seq_records.push_back(r);
+    }
+    // a '\r' at the end of the previous input was held back, since it
+    // is dropped if it was just before a '\n'
+    if (pending_cr) {
+      pending_cr = false;
+      if (*p != '\n') {
+        *out++ = table[static_cast<unsigned char>('\r')];
+        ++n_bases;
+      }
+    }
+    size_t len = kernel(p, lim, out, table, codes);
+    const bool found_eol = (p + len < lim);
+    if (len > 0 && p[len - 1] == '\r') {
+      --len;
+      pending_cr = !found_eol;
+    }
+
+    out += len;
+    n_bases += len;
+    if (!found_eol)
+      return out - out_start;
+    p += (p[len] == '\r') ? len + 2 : len + 1;
+    at_line_start = true;
+  }
+  return out - out_start;
+}
+
+#endif
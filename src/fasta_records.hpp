@@ -0,0 +1,102 @@
+/* fasta_records: the table of sequences (e.g. chromosomes) in a FASTA
+ * file, used to turn a position in the text into a sequence name and
+ * an offset within that sequence.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: the "text" seen by the search programs is all the sequences in
+// the file one after the other, with the names removed and a single
+// separator character between consecutive sequences. The separator
+// can never be part of a pattern, so no match can start in one
+// sequence and end in the next. Sequence i starts at position
+// records[i].offset and the separator after it is at position
+// records[i].offset + records[i].length.
+
+#ifndef FASTA_RECORDS_HPP
+#define FASTA_RECORDS_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// the character placed between sequences; it is the character that
+// starts a name line, so it is never a valid character in a sequence
+static const char fasta_separator = '>';
+
+
+// used to compare text and pattern regardless of case
+static inline char
+fasta_upper(const char c) {
+  return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+
+// The complement of a base, keeping the case; anything else (e.g. N,
+// or the separator) is its own complement
+static inline char
+fasta_complement(const char c) {
+  switch (c) {
+  case 'A': return 'T'; case 'C': return 'G';
+  case 'G': return 'C'; case 'T': return 'A';
+  case 'a': return 't'; case 'c': return 'g';
+  case 'g': return 'c'; case 't': return 'a';
+  default: return c;
+  }
+}
+
+
+// the pattern as it would be read on the other strand
+static inline std::string
+fasta_reverse_complement(const std::string &P) {
+  std::string R(P.rbegin(), P.rend());
+  std::transform(begin(R), end(R), begin(R), fasta_complement);
+  return R;
+}
+
+
+struct fasta_record {
+  std::string name;
+  size_t offset; // position of the first base in the text
+  size_t length; // number of bases
+  size_t start;  // position of the first base in the named sequence,
+                 // which is not 0 only when part of it was loaded
+};
+
+
+// The name of a sequence is the name line after the '>' up to the
+// first space or tab, just like samtools. The "line" here starts just
+// after the '>'.
+static inline size_t
+fasta_name_length(const char *line, const size_t len) {
+  size_t i = 0;
+  while (i < len && line[i] != ' ' && line[i] != '\t' && line[i] != '\r')
+    ++i;
+  return i;
+}
+
+
+// Index of the record containing position "pos" in the text, found by
+// binary search on the record offsets. The records must not be empty,
+// and a separator position is assigned to the record before it.
+static inline size_t
+fasta_locate(const std::vector<fasta_record> &records, const size_t pos) {
+  return std::upper_bound(begin(records), end(records), pos,
+                          [](const size_t p, const fasta_record &r) {
+                            return p < r.offset;
+                          }) - begin(records) - 1;
+}
+
+#endif
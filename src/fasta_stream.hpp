@@ -0,0 +1,231 @@
+/* fasta_stream: read a FASTA format file, or a pipe, in fixed-size
+ * blocks and hand the sequence to a search kernel one piece at a
+ * time, without ever holding the whole text in memory.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: this has the same "for_each_line" as fasta_mmap.hpp, so any
+// kernel written for one works with the other. The difference is that
+// here the file can be bigger than memory, or can be the output of
+// another program (e.g. "zcat genome.fa.gz | kmp_fasta -s ACGT -").
+// The price is that we only get one pass through the text, and the
+// kernel must keep its state between the pieces it is given. Memory
+// used is the size of two blocks, plus whatever the kernel needs. The
+// table of sequences (see fasta_records.hpp) grows as the names are
+// found, so the last record is always the one being scanned.
+//
+// Each block is put through the normalizer (see fasta_normalize.hpp)
+// as soon as it is read, so the kernel is given one piece per block,
+// already in upper case, or encoded if "codes" are given. The input
+// can be compressed with gzip or bgzip (see fasta_input.hpp), which is
+// found from its first bytes, so "kmp_fasta -s ACGT genome.fa.gz"
+// works without the "zcat".
+//
+// Reading and scanning happen at the same time: a reader thread fills
+// one block while the kernel scans the other, and then they swap. So
+// when the disk (or decompression) is slow, the time is the slower of
+// reading and scanning rather than their sum. The kernel is always
+// called from the thread that called "for_each_line", in order, so it
+// does not need to know about the reader thread at all.
+
+#ifndef FASTA_STREAM_HPP
+#define FASTA_STREAM_HPP
+
+#include "fasta_records.hpp"
+#include "fasta_normalize.hpp"
+#include "fasta_input.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+class fasta_stream {
+public:
+  static const size_t default_block_size = 1ul << 20; // 1MB
+
+  // the filename "-" means standard input
+  explicit fasta_stream(const std::string &filename,
+                        const size_t block_size = default_block_size,
+                        const dna_codes *codes = nullptr);
+  ~fasta_stream();
+
+  fasta_stream(const fasta_stream &) = delete;
+  fasta_stream &operator=(const fasta_stream &) = delete;
+
+  // Visit the text in order, as f(piece, len, pos) with "pos" the
+  // position in the text of piece[0]. Each piece is the sequence from
+  // one block of the file, with names and ends of lines removed and
+  // separators between sequences. This can be called only once.
+  template<class F> void for_each_line(F f);
+
+  // number of bases seen so far, which is the size of the text once
+  // "for_each_line" has returned
+  size_t size() const {return normalizer.size();}
+
+  // the sequences seen so far
+  const std::vector<fasta_record> &records() const {
+    return normalizer.records();
+  }
+
+private:
+  size_t read_block(std::vector<char> &buf);
+
+  std::string filename;
+  int fd;
+  std::unique_ptr<fasta_input> input;
+  std::vector<char> bufs[2]; // one is read while the other is scanned
+  std::vector<char> out;
+  fasta_normalizer normalizer;
+};
+
+
+inline
+fasta_stream::fasta_stream(const std::string &fn, const size_t block_size,
+                           const dna_codes *codes) :
+  filename(fn), fd(-1),
+  out(block_size + 1 + fasta_normalizer::slack), normalizer(codes) {
+
+  bufs[0].resize(block_size);
+  bufs[1].resize(block_size);
+  if (filename == "-")
+    fd = STDIN_FILENO;
+  else {
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("problem with file: " + filename);
+#ifdef POSIX_FADV_SEQUENTIAL
+    // ask the kernel to read ahead aggressively, so the reader thread
+    // rarely waits for the disk (fails harmlessly on systems without
+    // this)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+  try {
+    input.reset(new fasta_input(fd, filename));
+  }
+  catch (...) {
+    if (fd > STDIN_FILENO) close(fd);
+    throw;
+  }
+}
+
+
+inline
+fasta_stream::~fasta_stream() {
+  if (fd > STDIN_FILENO)
+    close(fd);
+}
+
+
+// fill the buffer as much as possible, since a pipe will give us
+// whatever it has at the moment (often just 64KB)
+inline size_t
+fasta_stream::read_block(std::vector<char> &buf) {
+  size_t filled = 0;
+  while (filled < buf.size()) {
+    const size_t r = input->read(buf.data() + filled, buf.size() - filled);
+    if (r == 0) break; // end of file
+    filled += r;
+  }
+  return filled;
+}
+
+
+template<class F> void
+fasta_stream::for_each_line(F f) {
+  // "full[k]" says block k has been read and not yet scanned
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool full[2] = {false, false};
+  size_t filled[2] = {0, 0};
+  bool stop = false;
+  std::exception_ptr error;
+
+  std::thread reader([&]() {
+    for (size_t k = 0;; k ^= 1) {
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() {return !full[k] || stop;});
+        if (stop) return;
+      }
+      size_t n = 0;
+      try {
+        n = read_block(bufs[k]);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(mtx);
+        error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        filled[k] = n;
+        full[k] = true;
+      }
+      cv.notify_all();
+      if (n == 0) return; // end of file, or an error
+    }
+  });
+
+  // the reader must be stopped and joined however this ends
+  auto stop_reader = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stop = true;
+    }
+    cv.notify_all();
+    reader.join();
+  };
+
+  try {
+    for (size_t k = 0;; k ^= 1) {
+      size_t n = 0;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() {return full[k];});
+        n = filled[k];
+      }
+      if (n == 0) break;
+      const size_t pos = normalizer.size();
+      const size_t len = normalizer.normalize(bufs[k].data(), n, out.data());
+      if (len > 0)
+        f(out.data(), len, pos);
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        full[k] = false;
+      }
+      cv.notify_all();
+    }
+  }
+  catch (...) {
+    stop_reader();
+    throw;
+  }
+  stop_reader();
+  if (error)
+    std::rethrow_exception(error);
+  normalizer.finish();
+}
+
+#endif
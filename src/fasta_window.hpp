@@ -0,0 +1,80 @@
+/* fasta_window: give a search kernel the text in long pieces that
+ * overlap, for kernels that need to look back or jump ahead.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: the KMP scan only needs one letter at a time, so it works on
+// the pieces that "for_each_line" gives, however short. Algorithms
+// like Boyer-Moore compare the pattern right to left and then jump
+// ahead, so they need the text they look at to be in one place. Here
+// the pieces are put together into "windows" of at least "min_size"
+// letters, and each window starts with the last "overlap" letters of
+// the one before. With "overlap" one less than the length of the
+// pattern, every match is entirely inside some window, and it is in
+// exactly one of them: a match can't fit in the overlap alone. So a
+// kernel searches each window on its own and reports only the matches
+// it finds, and none are lost or found twice.
+//
+// A piece that is long enough (e.g. the whole text of a fasta_subset,
+// or a block of a fasta_stream) is given to the kernel where it is,
+// without being copied.
+
+#ifndef FASTA_WINDOW_HPP
+#define FASTA_WINDOW_HPP
+
+#include <string>
+#include <algorithm>
+
+// Calls f(window, len, pos) for the text of T in order, with "pos" the
+// position of window[0] in the text, and each window after the first
+// starting with the last "overlap" letters of the one before.
+template<class Text, class F> static void
+fasta_for_each_window(Text &T, const size_t overlap, F f,
+                      size_t min_size = 1ul << 20) {
+  min_size = std::max(min_size, overlap + 1);
+  std::string buf;
+  size_t buf_pos = 0;       // position in the text of buf[0]
+  bool new_letters = false; // has buf any letters not yet given to f?
+  T.for_each_line([&](const char *piece, const size_t len, const size_t pos) {
+    if (len >= min_size) {
+      // First the letters before this piece with the start of it, for
+      // matches that cross into it. None can be in the start alone.
+      if (!buf.empty()) {
+        buf.append(piece, overlap);
+        f(buf.data(), buf.size(), buf_pos);
+      }
+      f(piece, len, pos);
+      buf.assign(piece + len - overlap, overlap);
+      buf_pos = pos + len - overlap;
+      new_letters = false;
+      return;
+    }
+    if (buf.empty())
+      buf_pos = pos;
+    buf.append(piece, len);
+    new_letters = true;
+    if (buf.size() >= min_size + overlap) {
+      f(buf.data(), buf.size(), buf_pos);
+      buf.erase(0, buf.size() - overlap);
+      buf_pos = pos + len - overlap;
+      new_letters = false;
+    }
+  });
+  if (new_letters)
+    f(buf.data(), buf.size(), buf_pos);
+}
+
+#endif
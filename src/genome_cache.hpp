@@ -0,0 +1,383 @@
+/* genome_cache: a binary file holding a FASTA file already packed in
+ * 2 bits per base, so programs can map it and start searching right
+ * away instead of reading and encoding the FASTA file every time.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: the cache for "genome.fa" is "genome.fa.pdna" and is made by
+// the "compile_reference" program. The layout of the file is:
+//
+//   header             (genome_cache_header below)
+//   sequence table     (n_records of genome_cache_record)
+//   runs of N etc.     (n_runs of genome_cache_run)
+//   sequence names     (names_size bytes, padded to 8 bytes)
+//   packed bases       (n_words 64-bit words, as in packed_dna.hpp)
+//
+// Everything is written in the byte order of the machine that made
+// it. The header has the size and modification time of the FASTA
+// file when the cache was made; if either one has changed, the cache
+// is "stale" and the programs go back to reading the FASTA file. The
+// checksum covers everything after the header, but checking it means
+// reading the whole file, so only "compile_reference -c" does that.
+
+#ifndef GENOME_CACHE_HPP
+#define GENOME_CACHE_HPP
+
+#include "packed_dna.hpp"
+#include "fasta_mmap.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char genome_cache_magic[8] = {'P', 'D', 'N', 'A', 'C', 'A', 'C', 'H'};
+static const uint32_t genome_cache_version = 1;
+
+struct genome_cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t source_size;     // of the FASTA file
+  int64_t source_mtime;     // of the FASTA file, in seconds
+  uint64_t n_bases;
+  uint64_t n_records;
+  uint64_t n_runs;
+  uint64_t names_size;
+  uint64_t words_offset;    // where the packed bases start
+  uint64_t n_words;
+  uint64_t checksum;
+};
+
+struct genome_cache_record {
+  uint64_t offset;
+  uint64_t length;
+  uint64_t name_offset;     // into the names
+  uint64_t name_length;
+};
+
+struct genome_cache_run {
+  uint64_t start;
+  uint64_t length;
+  uint64_t letter;
+};
+
+enum genome_cache_state {
+  genome_cache_missing,
+  genome_cache_fresh,
+  genome_cache_stale
+};
+
+
+static inline std::string
+genome_cache_name(const std::string &fasta_filename) {
+  return fasta_filename + ".pdna";
+}
+
+
+// FNV-1a, but on 64-bit words instead of bytes so it is fast enough
+// for a whole genome
+static inline uint64_t
+genome_cache_hash(uint64_t h, const uint64_t *x, const size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    h = (h ^ x[i])*0x100000001b3ull;
+  return h;
+}
+static const uint64_t genome_cache_hash_init = 0xcbf29ce484222325ull;
+
+
+static inline size_t
+genome_cache_round8(const size_t x) {return (x + 7) & ~size_t(7);}
+
+
+// Is there a cache for this FASTA file that we can use? Only the
+// header of the cache is read.
+static inline genome_cache_state
+genome_cache_check(const std::string &cache_filename,
+                   const std::string &fasta_filename) {
+  const int fd = open(cache_filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return genome_cache_missing;
+  genome_cache_header h;
+  const ssize_t r = pread(fd, &h, sizeof(h), 0);
+  close(fd);
+
+  struct stat st;
+  if (r != sizeof(h) ||
+      std::memcmp(h.magic, genome_cache_magic, sizeof(h.magic)) != 0 ||
+      h.version != genome_cache_version ||
+      stat(fasta_filename.c_str(), &st) != 0 ||
+      h.source_size != static_cast<uint64_t>(st.st_size) ||
+      h.source_mtime != static_cast<int64_t>(st.st_mtime))
+    return genome_cache_stale;
+  return genome_cache_fresh;
+}
+
+
+// Should a program use the cache for this FASTA file? Says why not if
+// the cache is there but out of date.
+static inline bool
+use_genome_cache(const std::string &fasta_filename) {
+  const std::string cache_filename = genome_cache_name(fasta_filename);
+  const genome_cache_state state =
+    genome_cache_check(cache_filename, fasta_filename);
+  if (state == genome_cache_stale)
+    std::cerr << "warning: ignoring stale cache: " << cache_filename
+              << std::endl;
+  return state == genome_cache_fresh;
+}
+
+
+// Write the packed text of "fasta_filename" to "cache_filename". The
+// file is written under a temporary name and then renamed, so any
+// program starting at the same time sees either no cache or a
+// complete one.
+static inline void
+write_genome_cache(const std::string &cache_filename,
+                   const std::string &fasta_filename, const packed_dna &T) {
+  struct stat st;
+  if (stat(fasta_filename.c_str(), &st) != 0)
+    throw std::runtime_error("problem with file: " + fasta_filename);
+
+  // build the tables in memory; only the packed bases are big
+  std::string names;
+  std::vector<genome_cache_record> records;
+  for (size_t i = 0; i < T.records().size(); ++i) {
+    const fasta_record &r = T.records()[i];
+    const genome_cache_record x = {r.offset, r.length, names.size(), r.name.size()};
+    records.push_back(x);
+    names += r.name;
+  }
+  const size_t names_size = names.size();
+  names.resize(genome_cache_round8(names_size), '\0');
+
+  std::vector<genome_cache_run> runs;
+  for (size_t i = 0; i < T.runs().size(); ++i) {
+    const packed_run &r = T.runs()[i];
+    const genome_cache_run x = {r.start, r.length,
+                                static_cast<unsigned char>(r.letter)};
+    runs.push_back(x);
+  }
+
+  genome_cache_header h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, genome_cache_magic, sizeof(h.magic));
+  h.version = genome_cache_version;
+  h.header_size = sizeof(h);
+  h.source_size = st.st_size;
+  h.source_mtime = st.st_mtime;
+  h.n_bases = T.size();
+  h.n_records = records.size();
+  h.n_runs = runs.size();
+  h.names_size = names_size;
+  h.words_offset = sizeof(h) + records.size()*sizeof(genome_cache_record) +
+    runs.size()*sizeof(genome_cache_run) + names.size();
+  h.n_words = T.size_in_words();
+
+  // every part is a multiple of 8 bytes, so the checksum can go one
+  // 64-bit word at a time through all of them
+  uint64_t c = genome_cache_hash_init;
+  c = genome_cache_hash(c, reinterpret_cast<const uint64_t *>(records.data()),
+                        records.size()*sizeof(genome_cache_record)/8);
+  c = genome_cache_hash(c, reinterpret_cast<const uint64_t *>(runs.data()),
+                        runs.size()*sizeof(genome_cache_run)/8);
+  c = genome_cache_hash(c, reinterpret_cast<const uint64_t *>(names.data()),
+                        names.size()/8);
+  c = genome_cache_hash(c, T.words(), T.size_in_words());
+  h.checksum = c;
+
+  const std::string tmp_filename = cache_filename + ".tmp";
+  FILE *out = fopen(tmp_filename.c_str(), "wb");
+  if (!out)
+    throw std::runtime_error("problem with file: " + tmp_filename);
+  const bool ok =
+    fwrite(&h, sizeof(h), 1, out) == 1 &&
+    fwrite(records.data(), sizeof(genome_cache_record),
+           records.size(), out) == records.size() &&
+    fwrite(runs.data(), sizeof(genome_cache_run), runs.size(), out) == runs.size() &&
+    fwrite(names.data(), 1, names.size(), out) == names.size() &&
+    fwrite(T.words(), sizeof(uint64_t),
+           T.size_in_words(), out) == T.size_in_words();
+  if (fclose(out) != 0 || !ok) {
+    std::remove(tmp_filename.c_str());
+    throw std::runtime_error("problem writing file: " + tmp_filename);
+  }
+  if (std::rename(tmp_filename.c_str(), cache_filename.c_str()) != 0)
+    throw std::runtime_error("problem with file: " + cache_filename);
+}
+
+
+// A mapped cache file. The packed text points into the mapping, so
+// the cache must outlive any use of text().
+class genome_cache {
+public:
+  explicit genome_cache(const std::string &cache_filename);
+  ~genome_cache() {
+    if (data != nullptr)
+      munmap(const_cast<char *>(data), filesize);
+  }
+  genome_cache(const genome_cache &) = delete;
+  genome_cache &operator=(const genome_cache &) = delete;
+
+  const packed_dna &text() const {return T;}
+  const genome_cache_header &header() const {return h;}
+
+  // does the checksum match? This reads the whole file
+  bool checksum_ok() const;
+
+private:
+  std::string filename;
+  const char *data;
+  size_t filesize;
+  genome_cache_header h;
+  packed_dna T;
+};
+
+
+inline
+genome_cache::genome_cache(const std::string &fn) :
+  filename(fn), data(nullptr), filesize(0) {
+
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("problem with file: " + filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(h)) {
+    close(fd);
+    throw std::runtime_error("not a genome cache: " + filename);
+  }
+  filesize = st.st_size;
+  void *m = mmap(nullptr, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    throw std::runtime_error("problem with file: " + filename);
+  data = static_cast<const char *>(m);
+
+  // Everything in the header is checked before it is used to find
+  // anything in the file, so a cache that is truncated or corrupt is
+  // "not a genome cache" and not a read past the end. The sums are
+  // written so they can't overflow.
+  std::memcpy(&h, data, sizeof(h));
+  const size_t bpw = packed_dna::bases_per_word;
+  bool good =
+    std::memcmp(h.magic, genome_cache_magic, sizeof(h.magic)) == 0 &&
+    h.version == genome_cache_version && h.header_size == sizeof(h) &&
+    h.n_words == h.n_bases/bpw + (h.n_bases % bpw != 0) &&
+    h.words_offset % 8 == 0 && h.words_offset >= sizeof(h) &&
+    h.words_offset <= filesize &&
+    h.n_words == (filesize - h.words_offset)/sizeof(uint64_t) &&
+    (filesize - h.words_offset) % sizeof(uint64_t) == 0;
+
+  // the records, runs and names must fit before the packed bases
+  size_t room = good ? h.words_offset - sizeof(h) : 0;
+  good = good && h.n_records <= room/sizeof(genome_cache_record);
+  room -= good ? h.n_records*sizeof(genome_cache_record) : 0;
+  good = good && h.n_runs <= room/sizeof(genome_cache_run);
+  room -= good ? h.n_runs*sizeof(genome_cache_run) : 0;
+  good = good && h.names_size <= room;
+
+  const genome_cache_record *rec =
+    reinterpret_cast<const genome_cache_record *>(data + sizeof(h));
+  const genome_cache_run *run =
+    reinterpret_cast<const genome_cache_run *>(rec + (good ? h.n_records : 0));
+  const char *names =
+    reinterpret_cast<const char *>(run + (good ? h.n_runs : 0));
+
+  // each name must be in the names, and the records and runs in order
+  // inside the text, as they are found by binary search
+  for (size_t i = 0; good && i < h.n_records; ++i)
+    good = rec[i].name_offset <= h.names_size &&
+      rec[i].name_length <= h.names_size - rec[i].name_offset &&
+      rec[i].offset <= h.n_bases &&
+      rec[i].length <= h.n_bases - rec[i].offset &&
+      (i == 0 || rec[i].offset >= rec[i - 1].offset);
+  for (size_t i = 0; good && i < h.n_runs; ++i)
+    good = run[i].start <= h.n_bases &&
+      run[i].length <= h.n_bases - run[i].start &&
+      (i == 0 || run[i].start >= run[i - 1].start + run[i - 1].length);
+
+  if (!good) {
+    munmap(const_cast<char *>(data), filesize);
+    data = nullptr;
+    throw std::runtime_error("not a genome cache (or wrong version): " +
+                             filename);
+  }
+
+  // the tables are small, so they are copied
+  std::vector<fasta_record> records(h.n_records);
+  for (size_t i = 0; i < h.n_records; ++i) {
+    records[i].name.assign(names + rec[i].name_offset, rec[i].name_length);
+    records[i].offset = rec[i].offset;
+    records[i].length = rec[i].length;
+  }
+  std::vector<packed_run> runs(h.n_runs);
+  for (size_t i = 0; i < h.n_runs; ++i) {
+    runs[i].start = run[i].start;
+    runs[i].length = run[i].length;
+    runs[i].letter = static_cast<char>(run[i].letter);
+  }
+
+  T = packed_dna::view(reinterpret_cast<const uint64_t *>(data + h.words_offset),
+                       h.n_bases, runs, records);
+}
+
+
+inline bool
+genome_cache::checksum_ok() const {
+  const uint64_t c =
+    genome_cache_hash(genome_cache_hash_init,
+                      reinterpret_cast<const uint64_t *>(data + sizeof(h)),
+                      (filesize - sizeof(h))/8);
+  return c == h.checksum;
+}
+
+
+// The packed text of a FASTA file: taken from its cache if there is a
+// fresh one, and otherwise packed from the FASTA file now
+class packed_genome {
+public:
+  explicit packed_genome(const std::string &fasta_filename) {
+    const std::string cache_filename = genome_cache_name(fasta_filename);
+    const genome_cache_state state =
+      genome_cache_check(cache_filename, fasta_filename);
+    if (state == genome_cache_fresh)
+      cache.reset(new genome_cache(cache_filename));
+    else {
+      if (state == genome_cache_stale)
+        std::cerr << "warning: ignoring stale cache: "
+                  << cache_filename << std::endl;
+      const fasta_mmap fm(fasta_filename);
+      T = packed_dna(fm);
+    }
+  }
+  const packed_dna &text() const {return cache ? cache->text() : T;}
+  bool from_cache() const {return cache != nullptr;}
+
+private:
+  std::unique_ptr<genome_cache> cache;
+  packed_dna T;
+};
+
+#endif
@@ -1,6 +1,6 @@
 /* kmp_fasta: A C++ implementation of the Knuth-Morris-Pratt algorithm
  * that takes the text from a FASTA format file and concatenates all
- * sequences in that file (including the name of the sequence).
+ * sequences in that file (without the names of the sequences).
  *
  * Copyright (C) 2024 Andrew D. Smith
  *
@@ -17,23 +17,82 @@
  * General Public License for more details.
  */
 
-// The language used here is roughly C++11. The file IO is done using
-// the C functions and not C++ because on Macos, for a long time (I
-// haven't checked in the past year) some part of the C++ libaries use
-// a signed 32-bit integer function for some buffer, which means that
-// reading an entire file of the size of the human genome will simply
-// not work. I never bothered to track the bug, since swapping to
-// `FILE*` for any single large read is easy.
+// The language used here is roughly C++11. The FASTA file is not read
+// into memory at all: it is mapped with `mmap` (see fasta_mmap.hpp)
+// and the scan below walks over the sequence lines where they sit in
+// the file, skipping the newlines and the names as it goes. An
+// earlier version used `fread` into one big buffer because on Macos
+// some part of the C++ libraries used a signed 32-bit integer for a
+// buffer size, so reading a file the size of the human genome through
+// streams would not work. Mapping the file avoids that problem too.
+//
+// With "-s" the file (or standard input, given as "-") is instead read
+// in blocks of fixed size (see fasta_stream.hpp), and only the number
+// of matches is kept, so memory does not depend on the size of the
+// text. This is for files bigger than memory, and for searching the
+// output of another program, for example:
+//
+// $ zcat hg38.fa.gz | ./kmp_fasta -s ACGTACGA -
+//
+// With "-2" the text is first packed into 2 bits per base (see
+// packed_dna.hpp) and the mapped file is released before the scan. If
+// "compile_reference" has made a cache of the packed text next to the
+// FASTA file, and the FASTA file has not changed since, the packed
+// text is mapped from the cache and nothing needs to be parsed.
+//
+// With "-p" each match is printed as the name of the sequence (e.g.
+// chromosome) and the offset of the match within that sequence, and
+// "-F bed" or "-F binary" prints them in those formats instead (see
+// match_writer.hpp). The count of matches is printed after them, or
+// to standard error for the binary format. Without "-p" the matches
+// are only counted, and never stored (see match_sink.hpp). With "-m 10"
+// the search stops after the first 10 matches.
+//
+// With "-R" the reverse complement of the pattern is searched for in
+// the same scan (see kmp_both_strands), and each match printed has its
+// strand. A pattern that is its own reverse complement is searched for
+// once, so no match is reported twice.
+//
+// With "-t 16" the text is split into 16 parts searched at the same
+// time (see parallel_Knuth_Morris_Pratt below).
+//
+// With "--region chr2:1000001-2000000" (or "-r"), or "--seqs chr2,chr3",
+// only those parts of the file are read, using the ".fai" index of
+// the file (see fasta_index.hpp), which is made the first time.
+//
+// With "-f primers.txt" each pattern in the file is searched for, with
+// the text loaded only once, and the searches for all of them spread
+// over the threads given with "-t" (see batch_Knuth_Morris_Pratt).
+//
+// With "-d" the scan uses the KMP automaton (see kmp_automaton below),
+// which takes one table lookup for each letter of the text, and never
+// follows failure links. With "-B" the scan is timed both ways on the
+// same text, which is how to see if this is worth it for a pattern.
+
+#include "fasta_mmap.hpp"
+#include "fasta_stream.hpp"
+#include "packed_dna.hpp"
+#include "genome_cache.hpp"
+#include "fasta_index.hpp"
+#include "match_sink.hpp"
+#include "pattern_file.hpp"
+#include "text_parts.hpp"
 
 #include <iostream>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <cstdlib>
+#include <thread>
+#include <functional>
+#include <system_error>
+#include <atomic>
+#include <utility>
+#include <chrono>
+#include <cctype>
+#include <cstdint>
 
-// these are to find the input file size and are available in unix/linux/macos
-#include <unistd.h>
-#include <sys/stat.h>
+#include <getopt.h>
 
 using std::vector;
 using std::string;
@@ -41,36 +100,6 @@ using std::string;
 using std::begin;
 using std::end;
 
-static void
-read_fasta_file_single_sequence(const string &filename, vector<char> &T) {
-
-  // In C++17 this can be replaced via std::filesystem
-  struct stat st;
-  stat(filename.c_str(), &st);
-  const size_t filesize = st.st_size;
-
-  T.resize(filesize);
-
-  FILE *in = fopen(filename.c_str(), "rb");
-  const size_t r = fread(&T[0], 1, filesize, in);
-  if (r != filesize) {
-    std::cerr << "failed to read file" << std::endl;
-    std::exit(EXIT_FAILURE);
-  }
-  fclose(in);
-
-  // remove all the newline characters
-  const auto x = std::remove(begin(T), end(T), '\n');
-  T.resize(std::distance(begin(T), x));
-  std::transform(begin(T), end(T), begin(T),
-                 [](char x) {return std::toupper(x);});
-  // note that if we assume the input FASTA file is the human genome,
-  // then this code would remove newlines, but would leave the names
-  // of each chromosome intact, and it could cause false-positives for
-  // some very short patterns (e.g., if pattern is just "c" since
-  // every chrom name has a "c").
-}
-
 
 /*
  * This function computes the "prefix" function for the pattern "P"
@@ -95,54 +124,750 @@ compute_prefix_function(const string &P, vector<size_t> &sp) {
 }
 
 
-static void
-Knuth_Morris_Pratt(const vector<char> &T, const string &P,
-                   const vector<size_t> &sp,
-                   vector<size_t> &matches) {
+// The usual KMP: the state "j" is the number of characters of P
+// matched so far, and a mismatch follows the failure links in "sp"
+// until some prefix of P can be extended.
+class kmp_matcher {
+public:
+  explicit kmp_matcher(const string &P) : P(P) {
+    compute_prefix_function(P, sp);
+  }
+  size_t size() const {return P.size();}
 
-  const size_t n = P.size();
-  const size_t m = T.size();
-
-  size_t j = 0;
-  for (size_t i = 0; i < m; ++i) {
+  // One step of the scan: update the state "j" for the next character
+  // "c" of the text, and say if a match of P ends at "c"
+  bool step(size_t &j, const char c_in) const {
+    const char c = fasta_upper(c_in);
 
     // look for the longest prefix of P that is the same as a suffix
     // of P[1..j - 1] AND has a different next character
-    while (j > 0 && P[j] != T[i])
+    while (j > 0 && P[j] != c)
       j = sp[j - 1];
 
     // check if the character matches
-    if (P[j] == T[i]) ++j;
+    if (P[j] == c) ++j;
 
     // if we have already successfully compared all positions in P,
     // then we have found a match
-    if (j == n) {
-      matches.push_back(i - n + 1);
+    if (j == P.size()) {
       j = sp[j - 1]; // shift by the length of the longest suffix of P
                      // that matches a prefix of P
+      return true;
     }
+    return false;
   }
-}
 
+private:
+  string P;
+  vector<size_t> sp;
+};
 
-int
-main(int argc, const char * const argv[]) {
 
-  if (argc != 3) {
-    std::cerr << "usage: " << argv[0] << " <pattern> <fasta-file>" << std::endl;
-    return EXIT_FAILURE;
+// KMP as a finite automaton: for each state j and each letter x, the
+// table says where to go next, so a step is one table lookup and never
+// a loop. The letters are those in P plus one code for everything
+// else, which for DNA is 5 (A, C, G, T and N), and both cases of a
+// letter get the same code. The table is built from the sp values:
+//
+//   delta[j][x] = j + 1           if P[j] is x
+//               = delta[sp[j - 1]][x]  otherwise (0 if j is 0)
+//
+// which is following the failure links ahead of time, for every x at
+// once. This is where sp' comes in: the link for a letter that would
+// fail again right away is never followed, since the row of the
+// state it leads to already says where that letter goes. The state
+// after a full match is n, and its row is that of sp[n - 1], so the
+// shift after a match is part of the table too.
+class kmp_automaton {
+public:
+  explicit kmp_automaton(const string &P);
+  size_t size() const {return n;}
+
+  bool step(size_t &j, const char c) const {
+    j = delta[(j << shift) | code[static_cast<unsigned char>(c)]];
+    return j == n;
   }
 
-  const string P(argv[1]);
+private:
+  size_t n;
+  size_t shift; // each row is 2^shift entries, so a row is j << shift
+  uint8_t code[256];
+  vector<uint32_t> delta;
+};
 
-  vector<char> T;
-  read_fasta_file_single_sequence(argv[2], T);
 
+inline
+kmp_automaton::kmp_automaton(const string &P) : n(P.size()), shift(0) {
   vector<size_t> sp;
   compute_prefix_function(P, sp);
 
-  vector<size_t> matches;
-  Knuth_Morris_Pratt(T, P, sp, matches);
+  // code 0 is for letters not in P
+  std::fill(code, code + 256, 0);
+  size_t sigma = 1;
+  for (size_t i = 0; i < n; ++i) {
+    const unsigned char c = P[i];
+    if (code[c] == 0) {
+      code[c] = sigma;
+      code[static_cast<unsigned char>(std::tolower(c))] = sigma;
+      ++sigma;
+    }
+  }
+  while ((size_t(1) << shift) < sigma) ++shift;
+
+  delta.resize((n + 1) << shift, 0);
+  for (size_t j = 0; j <= n; ++j)
+    for (size_t x = 0; x < sigma; ++x) {
+      if (j < n && code[static_cast<unsigned char>(P[j])] == x)
+        delta[(j << shift) | x] = j + 1;
+      else if (j > 0)
+        delta[(j << shift) | x] = delta[(sp[j - 1] << shift) | x];
+    }
+}
+
+
+// Both strands in one scan: a matcher for P and one for its reverse
+// complement, each with its own state, stepped on each letter. The two
+// states are packed into the one "j" of the scans below (the low and
+// high 32 bits), so the scans work the same with this as with the
+// others. P and its reverse complement have the same length, so a
+// match of each ends at the same place only if they are the same
+// string, and then only P is searched, with matches on the forward
+// strand, so none is reported twice.
+template<class Matcher> class kmp_both_strands {
+public:
+  explicit kmp_both_strands(const string &P) :
+    forward(P), reverse(fasta_reverse_complement(P)),
+    palindrome(fasta_reverse_complement(P) == P) {}
+  size_t size() const {return forward.size();}
+
+  match_strand step(size_t &j, const char c) const {
+    if (palindrome)
+      return forward.step(j, c) ? forward_strand : no_match;
+    size_t j_forward = j & 0xffffffffu;
+    size_t j_reverse = j >> 32;
+    const bool f = forward.step(j_forward, c);
+    const bool r = reverse.step(j_reverse, c);
+    j = j_forward | (j_reverse << 32);
+    return f ? forward_strand : (r ? reverse_strand : no_match);
+  }
+
+private:
+  Matcher forward;
+  Matcher reverse;
+  bool palindrome;
+};
+
+
+// The scan is the usual one, but done one line of the FASTA file at a
+// time. The only state is "j", which carries over from one line to
+// the next, so matches spanning lines (or blocks, when streaming) are
+// found as usual. The text "T" can be a fasta_mmap, a fasta_stream or
+// a packed_dna, and each match position is given to "sink" (see
+// match_sink.hpp), which can also be a lambda. The matcher "M" is
+// either of the two above. Once the sink is full the rest of the lines
+// are skipped.
+template<class Text, class Matcher, class Sink> static void
+Knuth_Morris_Pratt(Text &T, const Matcher &M, Sink &&sink) {
+
+  const size_t n = M.size();
+
+  size_t j = 0;
+  T.for_each_line([&](const char *line, const size_t len, const size_t pos) {
+    if (sink_full(sink)) return;
+    for (size_t k = 0; k < len; ++k)
+      if (const auto hit = M.step(j, line[k]))
+        report_match(sink, pos + k - n + 1, hit);
+  });
+}
+
+
+// Report the matches that start in [first, last), scanning from a
+// cursor and reading |P| - 1 letters past "last" for the matches that
+// start before it and end after it
+template<class Text, class Matcher, class Sink> static void
+scan_part(const Text &T, const Matcher &M, const size_t first,
+          const size_t last, Sink &&sink) {
+  const size_t n = M.size();
+  typename Text::cursor c(T, first);
+  size_t j = 0;
+  for (size_t i = first; i < last + n - 1; ++i)
+    if (const auto hit = M.step(j, c.next()))
+      report_match(sink, i - n + 1, hit);
+}
+
+
+// The positions where a match can start are split into "n_threads"
+// parts, and each thread scans its part from a cursor, reading |P| - 1
+// characters past the end of its part so matches crossing into the
+// next part are not lost. A thread keeps only the matches starting in
+// its own part, so a match at a seam is found by exactly one thread.
+// The matches of each thread are in order, and the parts are in
+// order, so they are put together by copying each thread's matches to
+// where they go in the result, which every thread can do at once. The
+// strands are kept the same way when both are searched.
+template<class Text, class Matcher> static void
+parallel_Knuth_Morris_Pratt(const Text &T, const Matcher &M,
+                            const size_t n_threads, position_sink &matches) {
+  const size_t n = M.size();
+  const size_t m = T.size();
+  if (n == 0 || m < n) return;
+
+  const size_t n_starts = m - n + 1;
+  const size_t n_parts = n_text_parts(n_starts, n_threads);
+
+  vector<position_sink> found(n_parts);
+  auto scan = [&](const size_t t) {
+    const size_t first = t*n_starts/n_parts;
+    const size_t last = (t + 1)*n_starts/n_parts; // one past the end
+    scan_part(T, M, first, last, found[t]);
+  };
+
+  vector<size_t> offset(n_parts + 1, 0);
+  auto copy = [&](const size_t t) {
+    std::copy(begin(found[t].matches), end(found[t].matches),
+              begin(matches.matches) + offset[t]);
+    std::copy(begin(found[t].strands), end(found[t].strands),
+              begin(matches.strands) + offset[t]);
+  };
+
+  run_parts(n_parts, scan);
+  size_t n_strands = 0;
+  for (size_t t = 0; t < n_parts; ++t) {
+    offset[t + 1] = offset[t] + found[t].count();
+    n_strands += found[t].strands.size();
+  }
+  matches.matches.resize(offset[n_parts]);
+  matches.strands.resize(n_strands); // all or none have a strand
+  run_parts(n_parts, copy);
+}
+
+
+// The number of matches in T, in parts as above when there are
+// threads, but without keeping any of the matches
+template<class Text, class Matcher> static size_t
+count_matches(const Text &T, const Matcher &M, const size_t n_threads) {
+  const size_t n = M.size();
+  const size_t m = T.size();
+  if (n == 0 || m < n) return 0;
+
+  if (n_threads <= 1) {
+    count_sink counter;
+    Knuth_Morris_Pratt(T, M, counter);
+    return counter.count();
+  }
+
+  const size_t n_starts = m - n + 1;
+  const size_t n_parts = n_text_parts(n_starts, n_threads);
+  vector<count_sink> counters(n_parts);
+  run_parts(n_parts, [&](const size_t t) {
+    scan_part(T, M, t*n_starts/n_parts, (t + 1)*n_starts/n_parts,
+              counters[t]);
+  });
+  size_t total = 0;
+  for (size_t t = 0; t < n_parts; ++t)
+    total += counters[t].count();
+  return total;
+}
+
+
+// all the matches in T, using threads if asked
+template<class Text, class Matcher> static void
+find_matches(const Text &T, const Matcher &M, const size_t n_threads,
+             position_sink &matches) {
+  if (n_threads > 1)
+    parallel_Knuth_Morris_Pratt(T, M, n_threads, matches);
+  else
+    Knuth_Morris_Pratt(T, M, matches);
+}
+
+
+// Searching for many patterns in one text, loaded once. Each pattern
+// is searched for in each chunk of the text, and each (pattern, chunk)
+// pair is a task. A thread takes the next task not yet taken, so no
+// thread waits while others work, even if some patterns match much
+// more often than others. The tasks go in order of chunk first, so at
+// any time the threads are all working on the same chunk (with
+// different patterns) and it stays in the cache. Each thread gives
+// its matches to its own copy of "sink", as sink(i, p) for pattern p,
+// and the copies are in "sinks" at the end.
+template<class Text, class Matcher, class Sink> static void
+batch_Knuth_Morris_Pratt(const Text &T, const vector<Matcher> &M,
+                         const size_t n_threads, const Sink &sink,
+                         vector<Sink> &sinks) {
+  static const size_t chunk_size = 1ul << 20;
+
+  const size_t m = T.size();
+  const size_t n_patterns = M.size();
+  const size_t n_chunks = std::max(size_t(1), (m + chunk_size - 1)/chunk_size);
+  const size_t n_tasks = n_chunks*n_patterns;
+
+  const size_t n_workers =
+    std::max(size_t(1), std::min(n_threads, n_tasks));
+  sinks.assign(n_workers, sink);
+  size_t max_n = 0;
+  for (size_t p = 0; p < n_patterns; ++p)
+    max_n = std::max(max_n, M[p].size());
+
+  std::atomic<size_t> next_task(0);
+  auto worker = [&](const size_t t) {
+    // The letters of the chunk, with enough after it for the longest
+    // pattern, are copied from the text once and then scanned for
+    // each pattern, which is faster than a cursor for each pattern.
+    string chunk;
+    size_t chunk_start = m; // none yet
+    size_t task = 0;
+    while ((task = next_task++) < n_tasks) {
+      const size_t p = task % n_patterns;
+      const size_t n = M[p].size();
+      const size_t first = (task/n_patterns)*chunk_size;
+      if (m < n || first >= m - n + 1)
+        continue;
+      const size_t last = std::min(m - n + 1, first + chunk_size);
+      if (chunk_start != first) {
+        chunk_start = first;
+        chunk.resize(std::min(m, first + chunk_size + max_n - 1) - first);
+        typename Text::cursor c(T, first);
+        for (size_t i = 0; i < chunk.size(); ++i)
+          chunk[i] = c.next();
+      }
+      const char *const letters = chunk.data() - first;
+      size_t j = 0;
+      for (size_t i = first; i < last + n - 1; ++i)
+        if (M[p].step(j, letters[i]))
+          sinks[t](i - n + 1, p);
+    }
+  };
+
+  // if a thread can't be started, the others do its tasks
+  vector<std::thread> threads;
+  try {
+    for (size_t t = 1; t < n_workers; ++t)
+      threads.push_back(std::thread(worker, t));
+  }
+  catch (std::system_error &) {}
+  worker(0);
+  for (size_t t = 0; t < threads.size(); ++t)
+    threads[t].join();
+}
+
+
+// the (pattern, position) of each match found by a thread in a batch
+struct batch_sink {
+  void operator()(const size_t i, const uint32_t p) {
+    found.push_back(std::make_pair(p, i));
+  }
+  vector<std::pair<uint32_t, size_t> > found;
+};
+
+
+// the matches of each pattern in order, from the batch sinks
+static void
+merge_batch_matches(const vector<batch_sink> &sinks, const size_t n_patterns,
+                    vector<vector<size_t> > &matches) {
+  matches.assign(n_patterns, vector<size_t>());
+  for (size_t t = 0; t < sinks.size(); ++t)
+    for (size_t i = 0; i < sinks[t].found.size(); ++i)
+      matches[sinks[t].found[i].first].push_back(sinks[t].found[i].second);
+  for (size_t p = 0; p < n_patterns; ++p)
+    std::sort(begin(matches[p]), end(matches[p]));
+}
 
-  std::cout << matches.size() << std::endl;
+
+// Each match is written as the sequence name and the offset in that
+// sequence, finding the sequence by binary search on the records, and
+// the strand if there are strands
+static void
+print_match_coordinates(const vector<fasta_record> &records,
+                        const vector<size_t> &matches, const size_t n,
+                        const uint32_t pattern_id, const string &pattern,
+                        match_writer &out,
+                        const vector<match_strand> &strands =
+                        vector<match_strand>()) {
+  for (size_t i = 0; i < matches.size(); ++i) {
+    const fasta_record &r = records[fasta_locate(records, matches[i])];
+    out.write(r.name, r.start + matches[i] - r.offset, n, pattern_id, pattern,
+              strands.empty() ? 0 : strands[i]);
+  }
+}
+
+
+struct kmp_options {
+  bool print_matches;
+  bool automaton;
+  bool benchmark;
+  size_t n_threads;
+  match_writer::format out_format;
+  size_t max_matches; // stop after this many, if not 0
+  bool both_strands;
+};
+
+
+// The counts go after the matches, but not into binary output
+static std::ostream &
+count_output(const kmp_options &opt) {
+  return (opt.print_matches && opt.out_format == match_writer::binary) ?
+    std::cerr : std::cout;
+}
+
+
+// Time the scan with the usual loop and with the automaton on the same
+// text, and check they find the same matches. The text is scanned once
+// before timing so it is in memory for both. Both matchers are made
+// before the timing starts, so only the scans are compared.
+template<class Text> static void
+benchmark_scans(const Text &T, const string &P, const size_t n_threads) {
+  typedef std::chrono::steady_clock clock;
+  const double megabytes = T.size()/1e6;
+
+  const kmp_matcher loop(P);
+  const kmp_automaton automaton(P);
+
+  position_sink warm_up;
+  find_matches(T, loop, n_threads, warm_up);
+
+  position_sink loop_matches;
+  const clock::time_point t0 = clock::now();
+  find_matches(T, loop, n_threads, loop_matches);
+  const std::chrono::duration<double> loop_time = clock::now() - t0;
+
+  position_sink automaton_matches;
+  const clock::time_point t1 = clock::now();
+  find_matches(T, automaton, n_threads, automaton_matches);
+  const std::chrono::duration<double> automaton_time = clock::now() - t1;
+
+  if (loop_matches.matches != automaton_matches.matches)
+    throw std::runtime_error("loop and automaton found different matches");
+
+  std::cout << "scan\tmatches\tseconds\tMB/s" << '\n'
+            << "loop\t" << loop_matches.count() << '\t' << loop_time.count()
+            << '\t' << megabytes/loop_time.count() << '\n'
+            << "automaton\t" << automaton_matches.count() << '\t'
+            << automaton_time.count() << '\t'
+            << megabytes/automaton_time.count() << std::endl;
+}
+
+
+// One scan of the text, with a sink for only what is needed (see
+// match_sink.hpp): the first matches with "-m", each match written as
+// it is found with "-p", or otherwise only the count. This works for a
+// fasta_stream too, as it never goes back in the text. The number of
+// matches is returned.
+template<class Text, class Matcher> static size_t
+scan_with_sink(Text &T, const Matcher &M, const kmp_options &opt) {
+  if (opt.max_matches > 0) {
+    first_k_sink first(opt.max_matches);
+    Knuth_Morris_Pratt(T, M, first);
+    if (opt.print_matches) {
+      match_writer out(opt.out_format);
+      print_match_coordinates(T.records(), first.matches, M.size(), 0, "",
+                              out, first.strands);
+      out.flush();
+    }
+    return first.count();
+  }
+  if (opt.print_matches) {
+    match_writer out(opt.out_format);
+    writer_sink writer(out, T.records(), M.size());
+    Knuth_Morris_Pratt(T, M, writer);
+    out.flush();
+    return writer.count();
+  }
+  count_sink counter;
+  Knuth_Morris_Pratt(T, M, counter);
+  return counter.count();
+}
+
+
+// With threads, the matches to print are put in order first, and
+// otherwise each thread only counts
+template<class Text, class Matcher> static size_t
+scan_text(const Text &T, const Matcher &M, const kmp_options &opt) {
+  if (opt.n_threads <= 1 || opt.max_matches > 0)
+    return scan_with_sink(T, M, opt);
+  if (!opt.print_matches)
+    return count_matches(T, M, opt.n_threads);
+  position_sink found;
+  parallel_Knuth_Morris_Pratt(T, M, opt.n_threads, found);
+  match_writer out(opt.out_format);
+  print_match_coordinates(T.records(), found.matches, M.size(), 0, "", out,
+                          found.strands);
+  out.flush();
+  return found.count();
+}
+
+
+// search a text that is all in memory (or mapped) and print the results
+template<class Text> static void
+search_text(const Text &T, const string &P, const kmp_options &opt) {
+  if (opt.benchmark) {
+    benchmark_scans(T, P, opt.n_threads);
+    return;
+  }
+  size_t n_matches = 0;
+  if (opt.both_strands)
+    n_matches = opt.automaton ?
+      scan_text(T, kmp_both_strands<kmp_automaton>(P), opt) :
+      scan_text(T, kmp_both_strands<kmp_matcher>(P), opt);
+  else
+    n_matches = opt.automaton ?
+      scan_text(T, kmp_automaton(P), opt) : scan_text(T, kmp_matcher(P), opt);
+  count_output(opt) << n_matches << std::endl;
+}
+
+
+// Search for all the patterns, with the matches of each given as the
+// name of the sequence, the offset in the sequence and the name of the
+// pattern, followed by the number of matches of each pattern
+// Without "-p" the threads only count the matches of each pattern
+template<class Text, class Matcher> static void
+batch_search_matchers(const Text &T, const vector<batch_pattern> &patterns,
+                      const vector<Matcher> &M, const kmp_options &opt) {
+  const size_t n_patterns = patterns.size();
+  vector<size_t> counts(n_patterns, 0);
+  if (opt.print_matches) {
+    vector<batch_sink> sinks;
+    batch_Knuth_Morris_Pratt(T, M, opt.n_threads, batch_sink(), sinks);
+    vector<vector<size_t> > matches;
+    merge_batch_matches(sinks, n_patterns, matches);
+    match_writer out(opt.out_format);
+    for (size_t p = 0; p < n_patterns; ++p) {
+      print_match_coordinates(T.records(), matches[p], patterns[p].seq.size(),
+                              p, patterns[p].name, out);
+      counts[p] = matches[p].size();
+    }
+    out.flush();
+  }
+  else {
+    vector<histogram_sink> sinks;
+    batch_Knuth_Morris_Pratt(T, M, opt.n_threads,
+                             histogram_sink(n_patterns), sinks);
+    for (size_t t = 0; t < sinks.size(); ++t)
+      for (size_t p = 0; p < n_patterns; ++p)
+        counts[p] += sinks[t].counts[p];
+  }
+  std::ostream &out = count_output(opt);
+  for (size_t p = 0; p < n_patterns; ++p)
+    out << patterns[p].name << '\t' << counts[p] << '\n';
+  out.flush();
+}
+
+
+template<class Text> static void
+search_batch(const Text &T, const vector<batch_pattern> &patterns,
+             const kmp_options &opt) {
+  if (opt.automaton) {
+    vector<kmp_automaton> M;
+    for (size_t i = 0; i < patterns.size(); ++i)
+      M.push_back(kmp_automaton(patterns[i].seq));
+    batch_search_matchers(T, patterns, M, opt);
+  }
+  else {
+    vector<kmp_matcher> M;
+    for (size_t i = 0; i < patterns.size(); ++i)
+      M.push_back(kmp_matcher(patterns[i].seq));
+    batch_search_matchers(T, patterns, M, opt);
+  }
+}
+
+
+// search while reading the file, so no more than the count is kept,
+// except for the first matches with "-m"
+template<class Matcher> static void
+search_stream(fasta_stream &T, const Matcher &M, const kmp_options &opt) {
+  count_output(opt) << scan_with_sink(T, M, opt) << std::endl;
+}
+
+
+static void
+print_usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [options] <pattern> <fasta-file>"
+            << std::endl
+            << "       " << prog << " [options] -f <patterns> <fasta-file>"
+            << std::endl
+            << "options:" << std::endl
+            << "  -f <file> search for each pattern in this file (one on"
+            << std::endl
+            << "            each line, \"name pattern\" lines, or FASTA)"
+            << std::endl
+            << "  -s        stream the file in blocks ('-' for stdin)"
+            << std::endl
+            << "  -b <MB>   block size when streaming (default: 1)"
+            << std::endl
+            << "  -p        print each match (sequence name and offset)"
+            << std::endl
+            << "  -F <fmt>  print each match as tsv (default), bed or binary"
+            << std::endl
+            << "  -m <k>    stop after the first k matches"
+            << std::endl
+            << "  -R        search both strands (matches marked + or -)"
+            << std::endl
+            << "  -2        pack the text in 2 bits per base first"
+            << std::endl
+            << "  -t <N>    search with N threads (not when streaming)"
+            << std::endl
+            << "  -d        scan with the KMP automaton (a table lookup"
+            << std::endl
+            << "            for each letter instead of the failure links)"
+            << std::endl
+            << "  -B        time the scan with and without the automaton"
+            << std::endl
+            << "  -r, --region <name:start-end>"
+            << std::endl
+            << "            search only this region (can be repeated)"
+            << std::endl
+            << "  --seqs <name,name,...>"
+            << std::endl
+            << "            search only these sequences"
+            << std::endl
+            << "(the packed text is used from <fasta-file>.pdna when that"
+            << std::endl
+            << " exists, see compile_reference)" << std::endl;
+}
+
+
+int
+main(int argc, char * const argv[]) {
+
+  bool streaming = false;
+  bool packed = false;
+  size_t block_size = fasta_stream::default_block_size;
+  vector<string> regions; // also the names given with "--seqs"
+  kmp_options kopt = {false, false, false, 1, match_writer::tsv, 0, false};
+  string patterns_file;
+
+  static const struct option long_options[] = {
+    {"region", required_argument, nullptr, 'r'},
+    {"seqs", required_argument, nullptr, 'S'},
+    {nullptr, 0, nullptr, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "sb:pF:m:R2r:t:dBf:",
+                            long_options, nullptr)) != -1) {
+    switch (opt) {
+    case 's':
+      streaming = true;
+      break;
+    case 'b':
+      block_size = std::strtoul(optarg, nullptr, 10) << 20;
+      break;
+    case 'p':
+      kopt.print_matches = true;
+      break;
+    case 'F':
+      if (!match_writer::parse_format(optarg, kopt.out_format)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      kopt.print_matches = true;
+      break;
+    case 'm':
+      kopt.max_matches = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'R':
+      kopt.both_strands = true;
+      break;
+    case '2':
+      packed = true;
+      break;
+    case 't':
+      kopt.n_threads = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'd':
+      kopt.automaton = true;
+      break;
+    case 'B':
+      kopt.benchmark = true;
+      break;
+    case 'f':
+      patterns_file = optarg;
+      break;
+    case 'r':
+      regions.push_back(optarg);
+      break;
+    case 'S':
+      split_fasta_names(optarg, regions);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!patterns_file.empty()) {
+    if (argc - optind != 1 || streaming || kopt.benchmark ||
+        kopt.max_matches > 0 || kopt.both_strands) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    try {
+      vector<batch_pattern> patterns;
+      read_patterns(patterns_file, patterns);
+      const string filename(argv[optind]);
+      if (filename == "-")
+        throw std::runtime_error("a file of patterns needs a FASTA file, "
+                                 "not standard input");
+      if (!regions.empty()) {
+        const fasta_index index(filename);
+        search_batch(fasta_subset(filename, index,
+                                  index.parse_regions(regions)),
+                     patterns, kopt);
+      }
+      else if (packed || use_genome_cache(filename)) {
+        const packed_genome G(filename);
+        search_batch(G.text(), patterns, kopt);
+      }
+      else
+        search_batch(fasta_mmap(filename), patterns, kopt);
+    }
+    catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (argc - optind != 2 || block_size == 0 || argv[optind][0] == '\0' ||
+      (kopt.benchmark && kopt.both_strands)) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    // the text is compared in upper case, so the pattern must be too
+    string P(argv[optind]);
+    std::transform(begin(P), end(P), begin(P), fasta_upper);
+
+    const string filename(argv[optind + 1]);
+
+    if (!regions.empty()) {
+      // only the bytes of these regions are read from the file
+      const fasta_index index(filename);
+      search_text(fasta_subset(filename, index, index.parse_regions(regions)),
+                  P, kopt);
+    }
+    else if (streaming || filename == "-") {
+      fasta_stream T(filename, block_size);
+      if (kopt.both_strands && kopt.automaton)
+        search_stream(T, kmp_both_strands<kmp_automaton>(P), kopt);
+      else if (kopt.both_strands)
+        search_stream(T, kmp_both_strands<kmp_matcher>(P), kopt);
+      else if (kopt.automaton)
+        search_stream(T, kmp_automaton(P), kopt);
+      else
+        search_stream(T, kmp_matcher(P), kopt);
+    }
+    else if (packed || use_genome_cache(filename)) {
+      // from the cache made by compile_reference if it is up to date
+      const packed_genome G(filename);
+      search_text(G.text(), P, kopt);
+    }
+    else
+      search_text(fasta_mmap(filename), P, kopt);
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
 }
@@ -0,0 +1,174 @@
+/* match_sink: what a search does with each match it finds, as a
+ * template parameter, so a search that only counts does only that.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: the searches used to put every match in a vector, and then the
+// program printed the size of the vector. For a pattern like "A" that
+// is hundreds of millions of positions, and gigabytes of memory, just
+// to get a count. Here the search is a template over its "sink", and
+// calls sink(i) for a match at position i (or sink(i, id) for pattern
+// number "id" when there are several patterns). The compiler makes a
+// separate search for each kind of sink, so with count_sink the
+// search only adds 1 to a number in a register for each match.
+//
+// A sink can also have "full()", which is true when no more matches
+// are wanted, so the search can stop early (see first_k_sink). The
+// searches ask with "sink_full(s)", which is false for anything
+// without it, so a lambda is still a sink.
+//
+// A search of both strands calls sink(i, strand) instead, where i is
+// still the position of the match in the text as given, and "strand"
+// says if the pattern or its reverse complement is there. A pattern
+// that is its own reverse complement (e.g. GAATTC) is searched for
+// only once, and its matches are on the forward strand, so no match is
+// reported twice.
+
+#ifndef MATCH_SINK_HPP
+#define MATCH_SINK_HPP
+
+#include "fasta_records.hpp"
+#include "match_writer.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// The strand of a match; "no_match" is false, so that the step of a
+// matcher for both strands can give this instead of a bool
+enum match_strand {
+  no_match = 0,
+  forward_strand = '+',
+  reverse_strand = '-'
+};
+
+
+// only the number of matches
+struct count_sink {
+  count_sink() : n(0) {}
+  void operator()(const size_t) {++n;}
+  void operator()(const size_t, const uint32_t) {++n;}
+  void operator()(const size_t, const match_strand) {++n;}
+  bool full() const {return false;}
+  size_t count() const {return n;}
+  size_t n;
+};
+
+
+// every match, and its strand if both strands are searched
+struct position_sink {
+  void operator()(const size_t i) {matches.push_back(i);}
+  void operator()(const size_t i, const match_strand s) {
+    matches.push_back(i);
+    strands.push_back(s);
+  }
+  bool full() const {return false;}
+  size_t count() const {return matches.size();}
+  std::vector<size_t> matches;
+  std::vector<match_strand> strands; // empty for one strand
+};
+
+
+// the first k matches, after which the search can stop
+struct first_k_sink : public position_sink {
+  explicit first_k_sink(const size_t k) : k(k) {}
+  void operator()(const size_t i) {
+    if (matches.size() < k) position_sink::operator()(i);
+  }
+  void operator()(const size_t i, const match_strand s) {
+    if (matches.size() < k) position_sink::operator()(i, s);
+  }
+  bool full() const {return matches.size() >= k;}
+  size_t k;
+};
+
+
+// Each match is written as soon as it is found, as a sequence and an
+// offset (see match_writer.hpp), so none are kept. The records can be
+// those of a fasta_stream, which have the sequences read so far, as
+// those include the one with the match.
+struct writer_sink {
+  writer_sink(match_writer &out, const std::vector<fasta_record> &records,
+              const size_t n, const uint32_t id = 0,
+              const std::string &name = "") :
+    out(out), records(records), n(n), id(id), name(name), n_written(0) {}
+  void operator()(const size_t i, const match_strand s = no_match) {
+    const fasta_record &r = records[fasta_locate(records, i)];
+    out.write(r.name, r.start + i - r.offset, n, id, name, s);
+    ++n_written;
+  }
+  bool full() const {return false;}
+  size_t count() const {return n_written;}
+  match_writer &out;
+  const std::vector<fasta_record> &records;
+  size_t n; // the length of the pattern
+  uint32_t id;
+  std::string name;
+  size_t n_written;
+};
+
+
+// the number of matches of each pattern, when there are several
+struct histogram_sink {
+  explicit histogram_sink(const size_t n_patterns) : counts(n_patterns, 0) {}
+  void operator()(const size_t, const uint32_t id) {++counts[id];}
+  bool full() const {return false;}
+  std::vector<size_t> counts;
+};
+
+
+// Each match of one of several patterns is written as soon as it is
+// found, with the name of the pattern, and counted for that pattern.
+// The patterns can have different lengths.
+struct patterns_writer_sink : public histogram_sink {
+  patterns_writer_sink(match_writer &out,
+                       const std::vector<fasta_record> &records,
+                       const std::vector<size_t> &lengths,
+                       const std::vector<std::string> &names) :
+    histogram_sink(names.size()), out(out), records(records),
+    lengths(lengths), names(names) {}
+  void operator()(const size_t i, const uint32_t id) {
+    const fasta_record &r = records[fasta_locate(records, i)];
+    out.write(r.name, r.start + i - r.offset, lengths[id], id, names[id]);
+    ++counts[id];
+  }
+  match_writer &out;
+  const std::vector<fasta_record> &records;
+  const std::vector<size_t> &lengths;
+  const std::vector<std::string> &names;
+};
+
+
+// Give the sink a match found by a matcher, whose step gives a bool
+// for one strand and a match_strand for both
+template<class Sink> static inline void
+report_match(Sink &sink, const size_t i, const bool) {sink(i);}
+
+template<class Sink> static inline void
+report_match(Sink &sink, const size_t i, const match_strand s) {sink(i, s);}
+
+
+// "s.full()" if the sink has it, and otherwise false
+template<class Sink> static inline auto
+sink_full_(const Sink &s, int) -> decltype(s.full()) {return s.full();}
+
+template<class Sink> static inline bool
+sink_full_(const Sink &, long) {return false;}
+
+template<class Sink> static inline bool
+sink_full(const Sink &s) {return sink_full_(s, 0);}
+
+#endif
@@ -0,0 +1,244 @@
+/* match_writer: write the matches found by a search quickly, as TSV,
+ * BED or a compact binary format.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: a pattern like "A" can have hundreds of millions of matches in
+// a genome, and writing each with "cout <<" takes much longer than
+// finding them: every "<<" goes through the locale and the stream
+// buffer, which is small. Here each match is formatted straight into
+// a large buffer, with the numbers written by "to_chars" (or a loop
+// like it before C++17), and the buffer goes to the file with one
+// call to "write" when it is full. This is as fast as the disk (or
+// the pipe) will take it.
+//
+// The formats, one line (or record) for each match:
+//
+//   tsv:    sequence, start, and the pattern name if there is one
+//   bed:    sequence, start, end, pattern id (the usual 0-based,
+//           half-open BED intervals)
+//   binary: records of 16 bytes: the sequence id and the pattern id as
+//           uint32, then the start as uint64, in the byte order of the
+//           machine. Sequence ids count from 0 in the order each
+//           sequence first has a match, and the first time a sequence
+//           has a match its name comes before it in a record of the
+//           uint32 0xffffffff, the uint32 length of the name, and the
+//           name itself.
+//
+// When both strands are searched the strand ('+' or '-') is the last
+// column of tsv, and for bed it comes after a score of 0, as in BED6.
+// In the binary format the top bit of the pattern id is set for a
+// match on the reverse strand.
+//
+// The pattern id is the position of the pattern in the list of
+// patterns searched, which is 0 for a program with one pattern.
+//
+// Anything written to the same file some other way (e.g. a count on
+// standard output with "cout") must come after "flush", or before the
+// first match is written, or the two can be mixed up.
+
+#ifndef MATCH_WRITER_HPP
+#define MATCH_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <stdexcept>
+#include <unordered_map>
+#include <algorithm>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#include <unistd.h>
+
+class match_writer {
+public:
+  enum format {tsv, bed, binary};
+
+  // "tsv", "bed" or "binary" into the format, false for anything else
+  static bool parse_format(const std::string &s, format &fmt);
+
+  static const size_t default_buffer_size = 1ul << 22;
+
+  explicit match_writer(const format f = tsv, const int out = STDOUT_FILENO,
+                        const size_t buffer_size = default_buffer_size) :
+    fmt(f), fd(out), buffer_size(buffer_size), used(0) {}
+
+  // anything not yet written is written, but errors are lost, so call
+  // flush to know the output is complete
+  ~match_writer() {
+    try {flush();}
+    catch (std::exception &) {}
+  }
+
+  format get_format() const {return fmt;}
+
+  // a match of the pattern with id "pattern_id" and "n" letters, at
+  // offset "start" in sequence "seq"; "pattern" is the name used in
+  // the tsv format, where it is left out if empty, and "strand" is
+  // '+' or '-', or 0 if only one strand is searched
+  void write(const std::string &seq, const size_t start, const size_t n,
+             const uint32_t pattern_id, const std::string &pattern = "",
+             const char strand = 0);
+
+  // write everything in the buffer to the file
+  void flush();
+
+private:
+  // room for "n" more bytes in the buffer, which is only made when the
+  // first match is written
+  char *reserve(const size_t n) {
+    if (used + n > buf.size()) {
+      flush();
+      if (n > buf.size()) buf.resize(std::max(n, buffer_size));
+    }
+    return buf.data() + used;
+  }
+  static char *put_number(char *p, const uint64_t x);
+  static char *put_string(char *p, const std::string &s) {
+    std::memcpy(p, s.data(), s.size());
+    return p + s.size();
+  }
+  uint32_t sequence_id(const std::string &seq);
+
+  format fmt;
+  int fd;
+  size_t buffer_size;
+  std::vector<char> buf;
+  size_t used;
+
+  // for the binary format
+  std::unordered_map<std::string, uint32_t> seq_ids;
+  std::string last_seq;
+  uint32_t last_id;
+};
+
+
+inline bool
+match_writer::parse_format(const std::string &s, format &f) {
+  if (s == "tsv") f = tsv;
+  else if (s == "bed") f = bed;
+  else if (s == "binary") f = binary;
+  else return false;
+  return true;
+}
+
+
+inline char *
+match_writer::put_number(char *p, const uint64_t x) {
+#if __cplusplus >= 201703L
+  return std::to_chars(p, p + 20, x).ptr;
+#else
+  char digits[20];
+  size_t n = 0;
+  uint64_t y = x;
+  do {
+    digits[n++] = '0' + y % 10;
+    y /= 10;
+  } while (y > 0);
+  while (n > 0)
+    *p++ = digits[--n];
+  return p;
+#endif
+}
+
+
+// Ids for the binary format. Matches in the same sequence come one
+// after another, so the name is usually the same as the last one.
+inline uint32_t
+match_writer::sequence_id(const std::string &seq) {
+  if (!seq_ids.empty() && seq == last_seq)
+    return last_id;
+  const auto found = seq_ids.find(seq);
+  if (found != seq_ids.end())
+    last_id = found->second;
+  else {
+    last_id = seq_ids.size();
+    seq_ids[seq] = last_id;
+    const uint32_t header[2] = {0xffffffffu, uint32_t(seq.size())};
+    char *p = reserve(sizeof(header) + seq.size());
+    std::memcpy(p, header, sizeof(header));
+    put_string(p + sizeof(header), seq);
+    used += sizeof(header) + seq.size();
+  }
+  last_seq = seq;
+  return last_id;
+}
+
+
+inline void
+match_writer::write(const std::string &seq, const size_t start,
+                    const size_t n, const uint32_t pattern_id,
+                    const std::string &pattern, const char strand) {
+  if (fmt == binary) {
+    const uint32_t reverse = (strand == '-') ? 0x80000000u : 0;
+    const uint32_t ids[2] = {sequence_id(seq), pattern_id | reverse};
+    const uint64_t pos = start;
+    char *p = reserve(sizeof(ids) + sizeof(pos));
+    std::memcpy(p, ids, sizeof(ids));
+    std::memcpy(p + sizeof(ids), &pos, sizeof(pos));
+    used += sizeof(ids) + sizeof(pos);
+    return;
+  }
+  // the longest line: the names, three numbers, a score, a strand and
+  // six separators
+  char *const line = reserve(seq.size() + pattern.size() + 3*20 + 8);
+  char *p = put_string(line, seq);
+  *p++ = '\t';
+  p = put_number(p, start);
+  if (fmt == bed) {
+    *p++ = '\t';
+    p = put_number(p, start + n);
+    *p++ = '\t';
+    p = put_number(p, pattern_id);
+    if (strand) {
+      *p++ = '\t';
+      *p++ = '0';
+    }
+  }
+  else if (!pattern.empty()) {
+    *p++ = '\t';
+    p = put_string(p, pattern);
+  }
+  if (strand) {
+    *p++ = '\t';
+    *p++ = strand;
+  }
+  *p++ = '\n';
+  used += p - line;
+}
+
+
+inline void
+match_writer::flush() {
+  size_t done = 0;
+  while (done < used) {
+    const ssize_t w = ::write(fd, buf.data() + done, used - done);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      used = 0; // so the destructor does not try again
+      throw std::runtime_error(std::string("problem writing matches: ") +
+                               std::strerror(errno));
+    }
+    done += w;
+  }
+  used = 0;
+}
+
+#endif
@@ -27,11 +27,25 @@
  * $ cc -o naive naive.c
  *
  * and it should work with any C compiler.
+ *
+ * With GCC or clang on x86 there is also a faster version of the
+ * algorithm, which compares P[0] and P[n-1] to 16, 32 or 64 positions
+ * of the text with one instruction, using SSE2, AVX2 or AVX-512
+ * (whichever the CPU has, found when the program runs), and compares
+ * the rest of P only where both of those match. See naive_simd.hpp
+ * for more about it; this is the same thing written in C. Give "-s"
+ * before the pattern to use the simple loop instead.
  */
 #include <stdio.h>  /* for printing */
 #include <string.h> /* for "strlen" */
 #include <stdlib.h> /* for malloc */
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__GNUC__) || defined(__clang__))
+#define NAIVE_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
 int *
 grow_matches_array(const int n_matches, int *const matches, int *capacity) {
   /* could be done with realloc instead of malloc but this shows a bit
@@ -51,6 +65,119 @@ grow_matches_array(const int n_matches, int *const matches, int *capacity) {
   return tmp; /* this will become the new "matches" when passed back */
 }
 
+/* record a match at position i, growing the array when needed */
+static void
+add_match(const int i, int **matches, int *n_matches, int *capacity) {
+  if (*n_matches == *capacity)
+    *matches = grow_matches_array(*n_matches, *matches, capacity);
+  (*matches)[*n_matches] = i;
+  (*n_matches)++;
+}
+
+/* The naive algorithm from position "i" to the end of the text */
+static void
+naive_scalar(const char *T, const int m, const char *P, const int n, int i,
+             int **matches, int *n_matches, int *capacity) {
+  int j;
+  for (; i < m - n + 1; i++) {
+    j = 0;
+    while (j < n && (T[i + j] == P[j]))
+      j++;
+    if (j == n)
+      add_match(i, matches, n_matches, capacity);
+  }
+}
+
+#ifdef NAIVE_SIMD_X86
+
+/* The candidates in "mask" (bit k for position i + k) already match
+   the first and last letters of P, so only the middle is compared */
+#define NAIVE_VERIFY(mask, i)                                             \
+  while (mask != 0) {                                                     \
+    k = (i) + __builtin_ctzll(mask);                                      \
+    if (n <= 2 || memcmp(T + k + 1, P + 1, n - 2) == 0)                   \
+      add_match(k, matches, n_matches, capacity);                         \
+    mask &= mask - 1;                                                     \
+  }
+
+__attribute__((target("sse2"))) static int
+naive_sse2(const char *T, const int m, const char *P, const int n, int i,
+           int **matches, int *n_matches, int *capacity) {
+  const __m128i first = _mm_set1_epi8(P[0]);
+  const __m128i last = _mm_set1_epi8(P[n - 1]);
+  __m128i a, b;
+  unsigned long long mask;
+  int k;
+  /* the block at i needs the text up to i + 16 + n - 1 */
+  for (; i + 16 + n - 1 <= m; i += 16) {
+    a = _mm_loadu_si128((const __m128i *)(T + i));
+    b = _mm_loadu_si128((const __m128i *)(T + i + n - 1));
+    mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                     _mm_cmpeq_epi8(b, last)));
+    NAIVE_VERIFY(mask, i);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static int
+naive_avx2(const char *T, const int m, const char *P, const int n, int i,
+           int **matches, int *n_matches, int *capacity) {
+  const __m256i first = _mm256_set1_epi8(P[0]);
+  const __m256i last = _mm256_set1_epi8(P[n - 1]);
+  __m256i a, b;
+  unsigned long long mask;
+  int k;
+  for (; i + 32 + n - 1 <= m; i += 32) {
+    a = _mm256_loadu_si256((const __m256i *)(T + i));
+    b = _mm256_loadu_si256((const __m256i *)(T + i + n - 1));
+    mask = (unsigned)_mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+    NAIVE_VERIFY(mask, i);
+  }
+  return naive_sse2(T, m, P, n, i, matches, n_matches, capacity);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static int
+naive_avx512(const char *T, const int m, const char *P, const int n, int i,
+             int **matches, int *n_matches, int *capacity) {
+  const __m512i first = _mm512_set1_epi8(P[0]);
+  const __m512i last = _mm512_set1_epi8(P[n - 1]);
+  __m512i a, b;
+  unsigned long long mask;
+  int k;
+  for (; i + 64 + n - 1 <= m; i += 64) {
+    a = _mm512_loadu_si512(T + i);
+    b = _mm512_loadu_si512(T + i + n - 1);
+    mask = _mm512_cmpeq_epi8_mask(a, first) & _mm512_cmpeq_epi8_mask(b, last);
+    NAIVE_VERIFY(mask, i);
+  }
+  return naive_avx2(T, m, P, n, i, matches, n_matches, capacity);
+}
+
+#undef NAIVE_VERIFY
+
+#endif
+
+/* Use the widest instructions the CPU has for as much of the text as
+   they can do, then the simple loop for the last few positions */
+static void
+naive_fast(const char *T, const int m, const char *P, const int n,
+           int **matches, int *n_matches, int *capacity) {
+  int i = 0;
+#ifdef NAIVE_SIMD_X86
+  if (n > 0 && n <= m) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+      i = naive_avx512(T, m, P, n, i, matches, n_matches, capacity);
+    else if (__builtin_cpu_supports("avx2"))
+      i = naive_avx2(T, m, P, n, i, matches, n_matches, capacity);
+    else
+      i = naive_sse2(T, m, P, n, i, matches, n_matches, capacity);
+  }
+#endif
+  naive_scalar(T, m, P, n, i, matches, n_matches, capacity);
+}
+
 int main(const int argc, char *const argv[]) {
 
   /* Note: Originally the C language required variable declaration
@@ -62,17 +189,20 @@ int main(const int argc, char *const argv[]) {
   int n_matches;  /* counter for the number of matches */
   int capacity;   /* to keep track of the size of "matches" */
 
-  if (argc != 3) {
-    printf("input must be: naive <pattern> <text>\n");
+  int simple;     /* use the simple loop (with "-s") */
+
+  simple = (argc == 4 && strcmp(argv[1], "-s") == 0);
+  if (argc != 3 && !simple) {
+    printf("input must be: naive [-s] <pattern> <text>\n");
     return -1;
   }
 
   /* ADS: note below that assigning P and T does not copy, while
      determining their length takes linear time within 'strlen' */
-  P = argv[1];   /* let P point to the first arg */
+  P = argv[1 + simple]; /* let P point to the pattern arg */
   n = strlen(P); /* pattern length */
 
-  T = argv[2];   /* and T will point to the second arg */
+  T = argv[2 + simple]; /* and T will point to the text arg */
   m = strlen(T); /* length of text */
 
   capacity = 1; /* start with at least some space to store matches --
@@ -90,18 +220,22 @@ int main(const int argc, char *const argv[]) {
      size (where 'size' is 'n_matches'). */
 
   /* The naive string matching algorithm */
-  for (i = 0; i < m - n + 1; i++) {
-    j = 0;
-    while (j < n && (T[i + j] == P[j]))
-      j++;
-    if (j == n) {
-      matches[n_matches] = i;
-      /* if there is no room left in the matches array, grow it! */
-      if (n_matches == capacity)
-        matches = grow_matches_array(n_matches, matches, &capacity);
-      n_matches++;
+  if (simple) {
+    for (i = 0; i < m - n + 1; i++) {
+      j = 0;
+      while (j < n && (T[i + j] == P[j]))
+        j++;
+      if (j == n) {
+        /* if there is no room left in the matches array, grow it! */
+        if (n_matches == capacity)
+          matches = grow_matches_array(n_matches, matches, &capacity);
+        matches[n_matches] = i;
+        n_matches++;
+      }
     }
   }
+  else
+    naive_fast(T, m, P, n, &matches, &n_matches, &capacity);
 
   /* for (i = 0; i < n_matches; ++i) */
   /*   printf("%d\n", matches[i]); */
@@ -1,6 +1,6 @@
 /* naive: An implementation in C++ of the naive algorithm for exact
- * matching of a pattern in a text. This does not use the most modern
- * C++, and I don't think anything here is from C++11 or onward.
+ * matching of a pattern in a text. The algorithm itself does not use
+ * the most modern C++, but the code around it uses a bit of C++11.
  *
  * Copyright (C) 2023 Andrew D. Smith
  *
@@ -20,56 +20,197 @@
 /*
  * This code should compile with just this:
  *
- * $ c++ -o naive naive.cpp
+ * $ c++ -O3 -o naive naive.cpp -lz -pthread
  *
  * and it should work with any C++ compiler from the past 10 years,
  * though possibly there are some things here that won't work in the
  * earliest compilers (e.g., the ifstream constructed from a string).
+ * The "-lz -pthread" are for reading FASTA files (see
+ * fasta_stream.hpp), and the "-O3" matters a lot for the speed.
+ *
+ * The search uses the SIMD version of the naive algorithm (see
+ * naive_simd.hpp), and "-s" gives the loop below instead, which is
+ * the textbook algorithm. With "-g" the text is read from a FASTA
+ * file (or "-" for standard input), in blocks, so a genome can be
+ * searched without holding it in memory (this is not "-f", which for
+ * kmp_fasta and rabin-karp is a file of patterns):
+ *
+ * $ ./naive -g ACGTACGA genome.fa
+ *
+ * With "-p" each match is printed, as the name of the sequence and
+ * the offset in it, and "-F bed" or "-F binary" prints them in those
+ * formats (see match_writer.hpp). A text given on the command line is
+ * one sequence called "text". With "-R" the reverse complement of the
+ * pattern is found too, and each match has its strand.
  */
 
+#include "naive_simd.hpp"
+#include "fasta_stream.hpp"
+#include "fasta_window.hpp"
+#include "match_sink.hpp"
+
 #include <iostream>
 #include <string>
 #include <vector>
 #include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <unistd.h>
 
 using std::vector;
 using std::string;
 using std::cout;
 using std::endl;
 
-int main(int argc, const char * const argv[]) {
+// Each match is given to the "sink", which can keep it, write it or
+// just count it (see match_sink.hpp). The text is where it already is,
+// as for naive_search, so a window is searched without copying it.
+template<class Sink> static void
+naive(const char *T, const size_t m, const char *P, const size_t n,
+      Sink &&sink) {
+  if (n > m) return;
 
-  if (argc != 3) {
-    std::cerr << "must give a string as input!" << endl;
-    return EXIT_FAILURE;
+  const size_t lim = m - n + 1;
+  for (size_t i = 0; i < lim; ++i) {
+    size_t j = 0;
+    while (j < n && P[j] == T[i + j]) ++j;
+    if (j == n)
+      sink(i);
   }
+}
 
-  const string P(argv[1]);
-  const string T(argv[2]);
 
-  const size_t m = T.length();
+// one of the two searches on a part of the text, giving each match
+template<class F> static void
+search_window(const string &P, const char *w, const size_t len,
+              const bool plain, F f) {
+  if (plain)
+    naive(w, len, P.data(), P.length(), f);
+  else
+    naive_search(w, len, P.data(), P.length(), f);
+}
+
+
+// Search one part of the text, at offset "pos" in all of it. If P_rc
+// is not empty it is the reverse complement of P, and both are found
+// in the part while it is still in cache. Their matches are merged,
+// so they come out in order, with the strand of each. A pattern that
+// is its own reverse complement is only searched for once.
+template<class Sink> static void
+naive_window(const string &P, const string &P_rc, const char *w,
+             const size_t len, const size_t pos, const bool plain,
+             Sink &sink) {
+  if (P_rc.empty()) {
+    search_window(P, w, len, plain, [&](const size_t i) {sink(pos + i);});
+    return;
+  }
+  vector<size_t> fwd, rev;
+  search_window(P, w, len, plain, [&](const size_t i) {fwd.push_back(i);});
+  if (P_rc != P)
+    search_window(P_rc, w, len, plain,
+                  [&](const size_t i) {rev.push_back(i);});
+  size_t j = 0;
+  for (size_t i = 0; i < fwd.size(); ++i) {
+    for (; j < rev.size() && rev[j] < fwd[i]; ++j)
+      sink(pos + rev[j], reverse_strand);
+    sink(pos + fwd[i], forward_strand);
+  }
+  for (; j < rev.size(); ++j)
+    sink(pos + rev[j], reverse_strand);
+}
+
+
+// The text arrives in blocks, and a match can start in one block and
+// end in the next, so the windows searched overlap by n - 1 letters
+// (see fasta_window.hpp).
+template<class Sink> static void
+naive_fasta(const string &P, const string &P_rc, fasta_stream &T,
+            const bool plain, Sink &sink) {
   const size_t n = P.length();
+  fasta_for_each_window(T, n > 0 ? n - 1 : 0,
+                        [&](const char *w, const size_t len, const size_t pos) {
+    naive_window(P, P_rc, w, len, pos, plain, sink);
+  });
+}
 
-  vector<size_t> matches;
 
-  const size_t lim = m - n + 1;
-  for (size_t i = 0; i < lim; ++i) {
-    size_t j = 0;
-    while (j < n && P[j] == T[i + j]) ++j;
-    if (j == n)
-      matches.push_back(i);
+int main(int argc, char * const argv[]) {
+
+  bool plain = false;
+  bool fasta = false;
+  bool print_matches = false;
+  bool both_strands = false;
+  match_writer::format out_format = match_writer::tsv;
+  int opt;
+  while ((opt = getopt(argc, argv, "sgpRF:")) != -1) {
+    if (opt == 's') plain = true;
+    else if (opt == 'g') fasta = true;
+    else if (opt == 'p') print_matches = true;
+    else if (opt == 'R') both_strands = true;
+    else if (opt == 'F' && match_writer::parse_format(optarg, out_format))
+      print_matches = true;
+    else {
+      std::cerr << "usage: " << argv[0]
+                << " [-s] [-g] [-p] [-R] [-F tsv|bed|binary] <pattern> <text>"
+                << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind != 2) {
+    std::cerr << "must give a string as input!" << endl;
+    return EXIT_FAILURE;
   }
 
-  // the "stream" `cout` and the stream insertion operator `<<` below
-  // tend to be much slower than direct file output and formatting a
-  // string without using the `<<`. On the other hand, we try to avoid
-  // I/O if we want fast code anyway.
+  string P(argv[optind]);
+  const string text_arg(argv[optind + 1]);
 
-  // for (size_t i = 0; i < matches.size(); ++i)
-  //   cout << matches[i] << endl;
+  // The "stream" `cout` and the stream insertion operator `<<` tend
+  // to be much slower than direct file output and formatting a string
+  // without using the `<<`, so the matches are written with
+  // match_writer as they are found, and only the count uses `cout`.
+  // Without "-p" the matches are counted and not kept at all.
+  size_t n_matches = 0;
+  try {
+    match_writer out(out_format);
+    count_sink counter;
+    if (fasta) {
+      // the text from a FASTA file is in upper case
+      std::transform(begin(P), end(P), begin(P), fasta_upper);
+      const string P_rc(both_strands ? fasta_reverse_complement(P) : "");
+      fasta_stream T(text_arg);
+      writer_sink writer(out, T.records(), P.length());
+      if (print_matches)
+        naive_fasta(P, P_rc, T, plain, writer);
+      else
+        naive_fasta(P, P_rc, T, plain, counter);
+      n_matches = print_matches ? writer.count() : counter.count();
+    }
+    else {
+      const fasta_record text = {"text", 0, text_arg.length(), 0};
+      const vector<fasta_record> records(1, text);
+      const string P_rc(both_strands ? fasta_reverse_complement(P) : "");
+      writer_sink writer(out, records, P.length());
+      if (print_matches)
+        naive_window(P, P_rc, text_arg.data(), text_arg.length(), 0, plain,
+                     writer);
+      else
+        naive_window(P, P_rc, text_arg.data(), text_arg.length(), 0, plain,
+                     counter);
+      n_matches = print_matches ? writer.count() : counter.count();
+    }
+    out.flush();
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
 
-  cout << "n_matches=" << matches.size() << endl;
-  cout << "capacity=" << matches.capacity() << endl;
+  // not into binary output
+  std::ostream &counts = (print_matches && out_format == match_writer::binary) ?
+    std::cerr : cout;
+  counts << "n_matches=" << n_matches << endl;
 
   return EXIT_SUCCESS;
 }
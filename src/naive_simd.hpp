@@ -0,0 +1,177 @@
+/* naive_simd: the naive algorithm for exact matching, but looking at
+ * many positions of the text at once with SIMD instructions.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: at most positions of the text the naive algorithm stops after
+// comparing one or two letters, so most of its time is spent deciding
+// that a position is not a match. Here that decision is made for 16,
+// 32 or 64 positions with a few instructions: we fill one vector with
+// copies of P[0] and another with copies of P[n - 1], and compare them
+// to the text starting at positions i and i + n - 1. A position k in
+// the block can only be a match if both comparisons are true at k,
+// and the "and" of the two comparisons, as a bit mask, gives these
+// candidates. Only the candidates are compared to the rest of P.
+//
+// Using the last letter as well as the first makes a big difference
+// for DNA: with 4 letters, 1 in 4 positions matches P[0], but only 1
+// in 16 matches both. The pattern can be any length, and short ones
+// are where this helps most, since the textbook algorithms spend more
+// time on their tables than on the text.
+//
+// The widest instructions the CPU has (AVX-512, AVX2 or SSE2) are
+// picked when the program runs, as in fasta_normalize.hpp, and the
+// plain loop is used on other CPUs. Each version finishes the last
+// few positions with the next narrower one, so all give the same
+// matches in the same order.
+
+#ifndef NAIVE_SIMD_HPP
+#define NAIVE_SIMD_HPP
+
+#include <cstring>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__GNUC__) || defined(__clang__))
+#define NAIVE_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Calls report(i) for each i in [from, m - n] where P occurs in T, in
+// order, comparing one position at a time.
+template<class Report> static inline void
+naive_search_scalar(const char *T, const size_t m, const char *P,
+                    const size_t n, size_t from, Report &report) {
+  if (n > m) return;
+  for (; from + n <= m; ++from) {
+    size_t j = 0;
+    while (j < n && P[j] == T[from + j]) ++j;
+    if (j == n)
+      report(from);
+  }
+}
+
+
+// the candidates in "mask" (bit k for position i + k) that are matches;
+// the first and last letters already match, so only the middle is left
+#define NAIVE_SIMD_VERIFY(mask, i)                                      \
+  while (mask != 0) {                                                   \
+    const size_t k = (i) + __builtin_ctzll(mask);                       \
+    if (n <= 2 || std::memcmp(T + k + 1, P + 1, n - 2) == 0)            \
+      report(k);                                                        \
+    mask &= mask - 1;                                                   \
+  }
+
+
+#ifdef NAIVE_SIMD_X86
+
+template<class Report> __attribute__((target("sse2"))) static inline void
+naive_search_sse2(const char *T, const size_t m, const char *P,
+                  const size_t n, size_t i, Report &report) {
+  const __m128i first = _mm_set1_epi8(P[0]);
+  const __m128i last = _mm_set1_epi8(P[n - 1]);
+  // block [i, i + 16) needs the text up to i + 16 + n - 1
+  for (; i + 16 + n - 1 <= m; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(T + i));
+    const __m128i b =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(T + i + n - 1));
+    uint64_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                    _mm_cmpeq_epi8(b, last)));
+    NAIVE_SIMD_VERIFY(mask, i);
+  }
+  naive_search_scalar(T, m, P, n, i, report);
+}
+
+
+template<class Report> __attribute__((target("avx2"))) static inline void
+naive_search_avx2(const char *T, const size_t m, const char *P,
+                  const size_t n, size_t i, Report &report) {
+  const __m256i first = _mm256_set1_epi8(P[0]);
+  const __m256i last = _mm256_set1_epi8(P[n - 1]);
+  for (; i + 32 + n - 1 <= m; i += 32) {
+    const __m256i a =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(T + i));
+    const __m256i b =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(T + i + n - 1));
+    uint64_t mask = static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                            _mm256_cmpeq_epi8(b, last))));
+    NAIVE_SIMD_VERIFY(mask, i);
+  }
+  naive_search_sse2(T, m, P, n, i, report);
+}
+
+
+template<class Report>
+__attribute__((target("avx512f,avx512bw"))) static inline void
+naive_search_avx512(const char *T, const size_t m, const char *P,
+                    const size_t n, size_t i, Report &report) {
+  const __m512i first = _mm512_set1_epi8(P[0]);
+  const __m512i last = _mm512_set1_epi8(P[n - 1]);
+  for (; i + 64 + n - 1 <= m; i += 64) {
+    const __m512i a = _mm512_loadu_si512(T + i);
+    const __m512i b = _mm512_loadu_si512(T + i + n - 1);
+    uint64_t mask = _mm512_cmpeq_epi8_mask(a, first) &
+      _mm512_cmpeq_epi8_mask(b, last);
+    NAIVE_SIMD_VERIFY(mask, i);
+  }
+  naive_search_avx2(T, m, P, n, i, report);
+}
+
+#endif
+
+#undef NAIVE_SIMD_VERIFY
+
+
+enum naive_simd_level {naive_plain, naive_sse2, naive_avx2, naive_avx512};
+
+// the widest instructions the CPU can run, found once
+static inline naive_simd_level
+naive_select_level() {
+#ifdef NAIVE_SIMD_X86
+  static const naive_simd_level level = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) return naive_avx512;
+    if (__builtin_cpu_supports("avx2")) return naive_avx2;
+    return naive_sse2;
+  }();
+  return level;
+#else
+  return naive_plain;
+#endif
+}
+
+
+// Calls report(i) for each position i where P occurs in T, in order.
+// An empty pattern occurs at every position, as in the plain loop.
+template<class Report> static inline void
+naive_search(const char *T, const size_t m, const char *P, const size_t n,
+             Report report, const naive_simd_level level = naive_select_level()) {
+  if (n == 0 || n > m || level == naive_plain) {
+    naive_search_scalar(T, m, P, n, 0, report);
+    return;
+  }
+#ifdef NAIVE_SIMD_X86
+  if (level == naive_avx512)
+    naive_search_avx512(T, m, P, n, 0, report);
+  else if (level == naive_avx2)
+    naive_search_avx2(T, m, P, n, 0, report);
+  else
+    naive_search_sse2(T, m, P, n, 0, report);
+#endif
+}
+
+#endif
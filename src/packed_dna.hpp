@@ -0,0 +1,290 @@
+/* packed_dna: DNA sequence stored with 2 bits per base, and a sorted
+ * list of the runs of any other letters (N, IUPAC codes and the
+ * separators between sequences) kept to the side.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: a base is one of 4 letters, so it needs only 2 bits, and 32 of
+// them fit in a 64-bit word. The human genome then takes about 750MB
+// instead of 3GB as "char" or 12GB as "uint32_t". The letters that
+// are not A, C, G or T are stored as A (code 0) in the words, and we
+// remember where they really are in a list of "runs". In a genome
+// these letters come in long runs of N, so the list is short.
+//
+// Base i is in word i/32, at bits 2*(i%32) and 2*(i%32)+1, so the
+// first base in a word is in its lowest bits. This means "extract"
+// below gives 32 consecutive bases with the first one lowest, and
+// two sequences packed this way can be compared 32 bases at a time
+// with a single comparison of 64-bit integers.
+//
+// This has the same "for_each_line" and "cursor" as fasta_mmap.hpp,
+// so the same search kernels work on either. Upper and lower case are
+// not distinguished once packed.
+
+#ifndef PACKED_DNA_HPP
+#define PACKED_DNA_HPP
+
+#include "fasta_records.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// a run of "length" copies of a letter other than A, C, G or T
+struct packed_run {
+  size_t start;
+  size_t length;
+  char letter;
+};
+
+
+class packed_dna {
+public:
+  static const size_t bases_per_word = 32;
+
+  packed_dna() : w(nullptr), n_words(0), n_bases(0) {}
+  // pack a short sequence, e.g. a pattern
+  explicit packed_dna(const std::string &s);
+  // pack any text that has "for_each_line" and "records"
+  template<class Text> explicit packed_dna(Text &T);
+
+  // A packed text whose words are kept somewhere else, e.g. in a
+  // mapped file (see genome_cache.hpp), which must outlive it
+  static packed_dna view(const uint64_t *words, const size_t n_bases,
+                         const std::vector<packed_run> &runs,
+                         const std::vector<fasta_record> &records);
+
+  // Moving keeps the words where they are, but a copy would need to
+  // point its words at the new storage, and we never need copies.
+  packed_dna(packed_dna &&) = default;
+  packed_dna &operator=(packed_dna &&) = default;
+  packed_dna(const packed_dna &) = delete;
+  packed_dna &operator=(const packed_dna &) = delete;
+
+  size_t size() const {return n_bases;}
+
+  const uint64_t *words() const {return w;}
+  size_t size_in_words() const {return n_words;}
+  const std::vector<packed_run> &runs() const {return r;}
+  const std::vector<fasta_record> &records() const {return seq_records;}
+  size_t locate(const size_t pos) const {return fasta_locate(seq_records, pos);}
+
+  // 2-bit code of the base at position i: A=0, C=1, G=2, T=3; this is
+  // 0 for positions in the runs
+  uint8_t code(const size_t i) const {
+    return (w[i/bases_per_word] >> (2*(i % bases_per_word))) & 3u;
+  }
+
+  // the 32 bases starting at any position i, with the base at i in
+  // the lowest 2 bits; positions past the end are 0
+  uint64_t extract(const size_t i) const {
+    const size_t k = i/bases_per_word;
+    const size_t shift = 2*(i % bases_per_word);
+    uint64_t x = w[k] >> shift;
+    if (shift > 0 && k + 1 < n_words)
+      x |= w[k + 1] << (64 - shift);
+    return x;
+  }
+
+  // does any run overlap positions [pos, pos + len)?
+  bool masked_in(const size_t pos, const size_t len) const {
+    const size_t i = first_run_ending_after(pos);
+    return i < r.size() && r[i].start < pos + len;
+  }
+
+  // the letter at a position; the runs are found by binary search so
+  // this should not be used to scan the whole text
+  char operator[](const size_t i) const {
+    const size_t k = first_run_ending_after(i);
+    return (k < r.size() && r[k].start <= i) ? r[k].letter : "ACGT"[code(i)];
+  }
+
+  // does P occur at position "pos"? Compares 32 bases at a time, then
+  // checks that the runs inside the window are the same as in P
+  bool equal(const size_t pos, const packed_dna &P) const;
+
+  // same as in fasta_mmap: f(piece, len, pos) for the whole text in
+  // order, decoded into letters a few thousand at a time
+  template<class F> void for_each_line(F f) const;
+
+  // move forward one letter at a time, as in fasta_mmap
+  class cursor {
+  public:
+    cursor(const packed_dna &p, const size_t i) :
+      pd(&p), pos(i), run(p.first_run_ending_after(i)) {}
+    char next() {
+      const size_t i = pos++;
+      if (run < pd->r.size() && i >= pd->r[run].start) {
+        const char c = pd->r[run].letter;
+        if (i + 1 == pd->r[run].start + pd->r[run].length) ++run;
+        return c;
+      }
+      return "ACGT"[pd->code(i)];
+    }
+  private:
+    const packed_dna *pd;
+    size_t pos;
+    size_t run; // first run that ends after pos
+  };
+
+private:
+  void push(const char c);
+  size_t first_run_ending_after(const size_t pos) const {
+    return std::upper_bound(begin(r), end(r), pos,
+                            [](const size_t p, const packed_run &x) {
+                              return p < x.start + x.length;
+                            }) - begin(r);
+  }
+
+  std::vector<uint64_t> storage; // empty for a view
+  const uint64_t *w;
+  size_t n_words;
+  std::vector<packed_run> r;
+  std::vector<fasta_record> seq_records;
+  size_t n_bases;
+};
+
+
+inline void
+packed_dna::push(const char c) {
+  static const char dna2code[] = {
+    // 0 to 3 for ACGT in either case, 4 for anything else
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  };
+  if (n_bases % bases_per_word == 0)
+    storage.push_back(0);
+  const uint8_t x = (static_cast<unsigned char>(c) < 128) ?
+    dna2code[static_cast<unsigned char>(c)] : 4;
+  if (x < 4)
+    storage.back() |= static_cast<uint64_t>(x) << (2*(n_bases % bases_per_word));
+  else {
+    const char u = fasta_upper(c);
+    if (!r.empty() && r.back().letter == u &&
+        r.back().start + r.back().length == n_bases)
+      ++r.back().length;
+    else {
+      const packed_run run = {n_bases, 1, u};
+      r.push_back(run);
+    }
+  }
+  ++n_bases;
+}
+
+
+inline
+packed_dna::packed_dna(const std::string &s) : w(nullptr), n_words(0), n_bases(0) {
+  storage.reserve((s.size() + bases_per_word - 1)/bases_per_word);
+  for (size_t i = 0; i < s.size(); ++i)
+    push(s[i]);
+  w = storage.data();
+  n_words = storage.size();
+}
+
+
+template<class Text>
+packed_dna::packed_dna(Text &T) : w(nullptr), n_words(0), n_bases(0) {
+  storage.reserve((T.size() + bases_per_word - 1)/bases_per_word);
+  T.for_each_line([&](const char *line, const size_t len, size_t) {
+    for (size_t i = 0; i < len; ++i)
+      push(line[i]);
+  });
+  w = storage.data();
+  n_words = storage.size();
+  seq_records = T.records();
+}
+
+
+inline packed_dna
+packed_dna::view(const uint64_t *words, const size_t n_bases,
+                 const std::vector<packed_run> &runs,
+                 const std::vector<fasta_record> &records) {
+  packed_dna pd;
+  pd.w = words;
+  pd.n_words = (n_bases + bases_per_word - 1)/bases_per_word;
+  pd.n_bases = n_bases;
+  pd.r = runs;
+  pd.seq_records = records;
+  return pd;
+}
+
+
+inline bool
+packed_dna::equal(const size_t pos, const packed_dna &P) const {
+  const size_t n = P.size();
+  if (pos + n > n_bases) return false;
+
+  // 32 bases per comparison; the pattern words are aligned to the
+  // start of the pattern, so they can be used directly
+  size_t k = 0;
+  for (; k + bases_per_word <= n; k += bases_per_word)
+    if (extract(pos + k) != P.w[k/bases_per_word])
+      return false;
+  if (k < n) {
+    const uint64_t mask = (uint64_t(1) << 2*(n - k)) - 1;
+    if ((extract(pos + k) ^ P.w[k/bases_per_word]) & mask)
+      return false;
+  }
+
+  // The runs of the text, cut to the window, must be the runs of P.
+  // This is where an 'N' (stored as code 0) is told apart from 'A'.
+  size_t j = 0;
+  for (size_t i = first_run_ending_after(pos);
+       i < r.size() && r[i].start < pos + n; ++i, ++j) {
+    const size_t a = std::max(r[i].start, pos);
+    const size_t b = std::min(r[i].start + r[i].length, pos + n);
+    if (j == P.r.size() || P.r[j].start != a - pos ||
+        P.r[j].length != b - a || P.r[j].letter != r[i].letter)
+      return false;
+  }
+  return j == P.r.size();
+}
+
+
+template<class F> void
+packed_dna::for_each_line(F f) const {
+  static const size_t piece_size = 4096; // multiple of 32
+  char buf[piece_size];
+  size_t run = 0;
+  for (size_t pos = 0; pos < n_bases; pos += piece_size) {
+    const size_t len = std::min(piece_size, n_bases - pos);
+    // decode one word at a time
+    for (size_t i = 0; i < len; i += bases_per_word) {
+      uint64_t x = w[(pos + i)/bases_per_word];
+      const size_t lim = std::min(len, i + bases_per_word);
+      for (size_t k = i; k < lim; ++k, x >>= 2)
+        buf[k] = "ACGT"[x & 3u];
+    }
+    // then put back the letters from the runs
+    for (; run < r.size() && r[run].start < pos + len; ++run) {
+      const size_t a = std::max(r[run].start, pos);
+      const size_t b = std::min(r[run].start + r[run].length, pos + len);
+      std::fill(buf + (a - pos), buf + (b - pos), r[run].letter);
+      if (r[run].start + r[run].length > pos + len)
+        break; // the run continues into the next piece
+    }
+    f(buf, len, pos);
+  }
+}
+
+#endif
@@ -0,0 +1,82 @@
+/* pattern_file: read a file of patterns to search for all at once,
+ * such as a set of primers or probes.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef PATTERN_FILE_HPP
+#define PATTERN_FILE_HPP
+
+#include "fasta_records.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+// A pattern from a file of patterns, and the name it is reported by
+struct batch_pattern {
+  std::string name;
+  std::string seq;
+};
+
+
+// The patterns can be one on each line, either alone (and then it is
+// also its name) or after a name and a space or tab, or they can be
+// in FASTA format. Empty lines and lines starting with '#' are skipped.
+// The patterns are made upper case, like the text.
+static void
+read_patterns(const std::string &filename,
+              std::vector<batch_pattern> &patterns) {
+  std::ifstream in(filename);
+  if (!in)
+    throw std::runtime_error("problem with file: " + filename);
+  std::string line;
+  bool fasta = false;
+  while (getline(in, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty() || line[0] == '#')
+      continue;
+    if (line[0] == '>') {
+      const batch_pattern p = {
+        line.substr(1, fasta_name_length(line.data() + 1, line.size() - 1)), ""
+      };
+      patterns.push_back(p);
+      fasta = true;
+    }
+    else if (fasta)
+      patterns.back().seq += line;
+    else {
+      std::istringstream iss(line);
+      batch_pattern p;
+      iss >> p.name >> p.seq;
+      if (p.seq.empty())
+        p.seq = p.name;
+      patterns.push_back(p);
+    }
+  }
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    if (patterns[i].seq.empty())
+      throw std::runtime_error("empty pattern " + patterns[i].name +
+                               " in " + filename);
+    std::string &P = patterns[i].seq;
+    std::transform(begin(P), end(P), begin(P), fasta_upper);
+  }
+}
+
+#endif
@@ -18,15 +18,27 @@
  * General Public License for more details.
  */
 
+#include "fasta_mmap.hpp"
+#include "packed_dna.hpp"
+#include "genome_cache.hpp"
+#include "fasta_index.hpp"
+#include "match_sink.hpp"
+#include "pattern_file.hpp"
+#include "rabin_karp_simd.hpp"
+#include "text_parts.hpp"
+
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
 #include <cstdlib>
-#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
 #include <cmath>
 #include <stdexcept>
 
+#include <getopt.h>
+
 using std::vector;
 using std::string;
 using std::cout;
@@ -58,24 +70,29 @@ encode_base(const char base) {
    powers can be computed. The standard functions in C++ require a
    floating point argument, because the return value of integer powers
    need not be an integer, i.e. when the exponent is negative. This
-   function works for non-negative integers.
+   function works for non-negative integers, and gives the power
+   modulo q, taking the remainder at each step: otherwise the power
+   (e.g. 5 to the 28) does not fit in 64 bits, and the remainder of
+   what is left is wrong. The "q" must be less than 2^32 so that the
+   products fit.
  */
 static size_t
-nonneg_integer_power(size_t x, size_t n) {
-  if (n == 0) return 1;
+nonneg_integer_power(size_t x, size_t n, const size_t q) {
+  if (n == 0) return 1 % q;
+  x %= q;
   size_t y = 1;
   while (n > 1) {
     if (n & 1ul) { // if "n" is odd
-      y *= x;
-      x *= x;
+      y = (y*x) % q;
+      x = (x*x) % q;
       n = (n - 1)/2;
     }
     else { // if "n" is even
-      x *= x;
+      x = (x*x) % q;
       n = (n >> 1);
     }
   }
-  return x*y;
+  return (x*y) % q;
 }
 
 
@@ -90,108 +107,600 @@ subtract_mod(const size_t a, const size_t b, const size_t q) {
 }
 
 
-// This is where the Rabin-Karp happens
-static size_t
-Rabin_Karp(const string &T, const string &P,
-           const size_t d, const size_t q, vector<size_t> &matches) {
+// The arithmetic for the hash of a window of n letters in base d, as
+// in the book: "push" adds a letter on the right of the hash of fewer
+// than n letters, and "roll" takes the letter "out" off the left and
+// adds "in" on the right. This takes 3 remainders (divisions) for
+// each position of the text, and those take most of the time.
+struct mod_prime {
+  mod_prime(const size_t d, const size_t q, const size_t n) :
+    d(d), q(q), h(nonneg_integer_power(d, n - 1, q)) {}
+  size_t push(const size_t t, const size_t c) const {return (d*t + c) % q;}
+  size_t roll(const size_t t, const size_t out, const size_t in) const {
+    return (d*subtract_mod(t, (out*h) % q, q) % q + in) % q;
+  }
+  size_t d;
+  size_t q;
+  size_t h; // d^(n-1) mod q
+};
+
+
+// ADS: the same arithmetic modulo the prime q = 2^61 - 1 (a Mersenne
+// prime), for which there is no division at all. Since 2^61 is 1
+// modulo q, a number x is the same modulo q as its low 61 bits plus
+// the bits above them, so x is reduced with a mask, a shift and an
+// add, and then at most one subtraction of q. The products need more
+// than 64 bits, so they are done as 128-bit numbers (GCC and Clang
+// have these). Taking off the letter on the left is adding (q - c*h)
+// for the letter c, and those 5 numbers are computed once. With q so
+// large, two windows that differ almost never have the same hash.
+__extension__ typedef unsigned __int128 uint128_t;
+
+struct mod_mersenne {
+  static const uint64_t q = (uint64_t(1) << 61) - 1;
+  static uint64_t reduce(const uint128_t x) {
+    const uint64_t r = (uint64_t(x) & q) + uint64_t(x >> 61);
+    return r >= q ? r - q : r;
+  }
+  mod_mersenne(const size_t d, const size_t n) : d(d) {
+    uint64_t h = 1; // d^(n-1) mod q
+    for (size_t i = 1; i < n; ++i)
+      h = reduce(uint128_t(h)*d);
+    for (uint64_t c = 0; c < 5; ++c)
+      minus_out_h[c] = q - reduce(uint128_t(c)*h);
+  }
+  size_t push(const size_t t, const size_t c) const {
+    return reduce(uint128_t(t)*d + c);
+  }
+  size_t roll(const size_t t, const size_t out, const size_t in) const {
+    // t + (q - out*h) is less than 2q, so this fits in 64 bits
+    return reduce(uint128_t(t + minus_out_h[out])*d + in);
+  }
+  uint64_t d;
+  uint64_t minus_out_h[5];
+};
+
+
+// This is where the Rabin-Karp happens. The text is read through two
+// cursors: "lead" supplies the base entering the window and "trail"
+// the base leaving it. The bases are encoded as they are read, so no
+// encoded copy of the text is ever made. The text can be the mapped
+// FASTA file or the packed text, and "verify(s, trail, rc)" checks a
+// hit at position s, with "trail" a cursor at s, for the pattern or
+// (if "rc") its reverse complement. Each match goes to "sink" (see
+// match_sink.hpp), and the scan stops if the sink is full.
+//
+// Only the windows starting in [first, last) are searched, reading
+// n - 1 letters past "last", so a part of the text can be searched
+// on its own (see search_parts below). The hash of the first window
+// is computed from its letters, the same as the hash of the pattern.
+//
+// If "P_rc" is not empty it is the reverse complement of P, encoded
+// the same way, and both strands are searched: the one hash of the
+// window is compared with the hash of each, so the text is still read
+// once. A pattern that is its own reverse complement is only searched
+// for once, and its matches are on the forward strand.
+template<class Text, class Hash, class Verify, class Sink> static size_t
+Rabin_Karp(const Text &T, const string &P, const string &P_rc,
+           const Hash &H, Verify verify, Sink &&sink,
+           const size_t first, const size_t last) {
 
   const size_t n = P.size();
-  const size_t m = T.size();
+  const bool both_strands = !P_rc.empty();
+  const bool search_rc = both_strands && P_rc != P;
 
-  const long int h = nonneg_integer_power(d, n-1) % q;
+  typename Text::cursor lead(T, first);
+  typename Text::cursor trail(T, first);
 
-  // compute p and initialize t = t_0
+  // compute p (and p_rc) and initialize t = t_first
   size_t p = 0;
+  size_t p_rc = 0;
   size_t t = 0;
   for (size_t i = 0; i < n; ++i) {
-    p = (d*p + P[i]) % q;
-    t = (d*t + T[i]) % q;
+    p = H.push(p, P[i]);
+    if (search_rc) p_rc = H.push(p_rc, P_rc[i]);
+    t = H.push(t, encode_base(lead.next()));
   }
 
   size_t hit_counter = 0; // counter for hits; only used for analysis
 
-  for (size_t s = 0; s < m - n + 1; ++s) {
+  for (size_t s = first; s < last; ++s) {
     if (p == t) { // filter
       ++hit_counter;
-      // below, verify using the built-in C++ "equal" function for any
-      // sequence (could be a string or vector, etc.)
-      if (std::equal(begin(P), end(P), begin(T) + s))
-        matches.push_back(s); // append the match
+      if (verify(s, trail, false)) {
+        // report the match
+        if (both_strands) sink(s, forward_strand);
+        else sink(s);
+        if (sink_full(sink)) break;
+      }
+    }
+    if (search_rc && p_rc == t) {
+      ++hit_counter;
+      if (verify(s, trail, true)) {
+        sink(s, reverse_strand);
+        if (sink_full(sink)) break;
+      }
+    }
+    if (s + 1 < last) { // shift and update
+      const size_t out = encode_base(trail.next());
+      const size_t in = encode_base(lead.next());
+      t = H.roll(t, out, in);
     }
-    if (s < m - n) // shift and update
-      t = (d*subtract_mod(t, (T[s]*h) % q, q) % q + T[s+n]) % q;
   }
   return hit_counter;
 }
 
 
-// This function just removes the sequence (e.g. chromosome) names and
-// newlines from a string loaded from a FASTA file. It is not
-// optimized for speed, but it should be pretty clear.
-static void
-remove_names_newlines(string &T) {
-  bool outside_name = true;
-  size_t j = 0;
-  const size_t n = T.size();
+// verify by reading the window again from a copy of the cursor at the
+// start of the window; the separator between sequences encodes like
+// an 'N', so it is rejected explicitly
+template<class Cursor> static bool
+verify_window(Cursor v, const string &P) {
+  for (size_t j = 0; j < P.size(); ++j) {
+    const char c = v.next();
+    if (c == fasta_separator || P[j] != encode_base(c)) return false;
+  }
+  return true;
+}
+
+
+// ADS: the same search, modulo 2^61 - 1, with the hashes of 8 or 16
+// parts of the text moved along at once (see rabin_karp_simd.hpp).
+// The text is taken in rounds, and in each round lane l has the
+// "block" windows starting at round + l*block, so the parts are
+// interleaved, and the lanes read from near each other. The letters
+// of each lane are decoded with a cursor into a column of "codes".
+// The hits of each lane are kept until the round is done, then they
+// are verified and given to the sink lane by lane, so the matches are
+// in order. This needs d < 8 and a CPU with AVX2. As for Rabin_Karp,
+// only the windows starting in [first, last) are searched.
+template<class Text, class Verify, class Sink> static size_t
+Rabin_Karp_lanes(const Text &T, const string &P, const string &P_rc,
+                 const size_t d, Verify verify, Sink &&sink,
+                 const rk_simd_level level, const size_t first,
+                 const size_t last) {
+
+  const size_t n = P.size();
+  const size_t m = T.size();
+  const size_t L = rk_simd_lanes(level);
+  const bool both_strands = !P_rc.empty();
+  const bool search_rc = both_strands && P_rc != P;
+
+  const mod_mersenne H(d, n);
+  size_t p = 0;
+  size_t p_rc = 0;
   for (size_t i = 0; i < n; ++i) {
-    const char c = T[i];
-    if (outside_name) {
-      if (c == '>')
-        outside_name = false;
-      else if (c != '\n') {
-        T[j++] = c;
+    p = H.push(p, P[i]);
+    if (search_rc) p_rc = H.push(p_rc, P_rc[i]);
+  }
+  const rk_lane_consts c(d, n, p, p_rc, search_rc);
+
+  // the first n rows are "out" letters of 0 for the start of each
+  // hash, then the letters of the windows of the block
+  const size_t block = std::max(size_t(1) << 13, 8*n);
+  const size_t n_rows = block + 2*n - 1;
+  vector<uint8_t> codes(n_rows*L, 0);
+
+  vector<vector<std::pair<size_t, bool> > > hits(L);
+  auto hit = [&](const size_t k, const size_t lane, const bool rc) {
+    hits[lane].push_back(std::make_pair(k, rc));
+  };
+
+  size_t hit_counter = 0;
+  for (size_t round = first; round < last; round += L*block) {
+    for (size_t l = 0; l < L; ++l) {
+      const size_t start = round + l*block;
+      size_t r = n;
+      if (start < m) {
+        typename Text::cursor lead(T, start);
+        const size_t end = std::min(m, start + block + n - 1);
+        for (size_t j = start; j < end; ++j, ++r)
+          codes[r*L + l] = encode_base(lead.next());
+      }
+      for (; r < n_rows; ++r) // past the end of the text
+        codes[r*L + l] = 4;
+    }
+
+    rk_lanes(codes.data(), n, n_rows, c, hit, level);
+
+    for (size_t l = 0; l < L; ++l) {
+      for (size_t i = 0; i < hits[l].size(); ++i) {
+        const size_t s = round + l*block + hits[l][i].first + 1 - n;
+        if (s >= last) continue;
+        const bool rc = hits[l][i].second;
+        ++hit_counter;
+        if (verify(s, typename Text::cursor(T, s), rc)) {
+          if (both_strands) sink(s, rc ? reverse_strand : forward_strand);
+          else sink(s);
+          if (sink_full(sink)) return hit_counter;
+        }
       }
+      hits[l].clear();
     }
-    else outside_name = (c == '\n');
   }
-  // resize but keep capacity
-  T.resize(j);
+  return hit_counter;
 }
 
 
-// The "get_filesize" below uses some pretty specific C++ code for
-// "streams" and if you don't understand it, that's fine.
-static size_t
-get_filesize(const string &filename) {
-  std::ifstream in(filename);
-  if (!in)
-    throw runtime_error("problem with file: " + filename);
-  const std::streampos begin_pos = in.tellg();
-  in.seekg(0, std::ios_base::end);
-  return in.tellg() - begin_pos;
+// ADS: many patterns of the same length (e.g. a panel of probes) are
+// found in one pass. The hash of a window does not depend on the
+// pattern, so instead of comparing it with the hash of each pattern,
+// it is looked up in a table of all of them. The table uses open
+// addressing: the hash of a pattern goes in the first empty slot at or
+// after a slot given by the bits of the hash, and a lookup reads the
+// slots from there until it finds the hash or an empty slot. There
+// are at least twice as many slots as patterns, so a lookup usually
+// reads one slot, and the slots are 16 bytes each in one array, so
+// the table for thousands of patterns stays in the cache. Patterns
+// with the same hash (the same sequence twice, or a collision) are
+// kept in a list through "same".
+//
+// Almost every window of the text has no match, and then the lookup
+// ends at a slot that is empty or has some other hash, which is hard
+// for the processor to predict. So first one bit for the hash is
+// looked up in a "filter" with at least 32 bits for each pattern,
+// which is set only for the hashes of the patterns, and the table is
+// only searched if it is set.
+class fingerprint_table {
+public:
+  static const uint32_t none = 0xffffffffu;
+
+  // the patterns are encoded, and all have the same length
+  template<class Hash>
+  fingerprint_table(const vector<string> &P, const Hash &H);
+
+  // the first pattern with hash t, or "none"
+  uint32_t find(const uint64_t t) const {
+    const uint64_t x = spread(t);
+    const size_t b = x >> filter_shift;
+    if (!(filter[b >> 6] & (uint64_t(1) << (b & 63))))
+      return none;
+    size_t i = x >> shift;
+    while (slots[i].key != t) {
+      if (slots[i].key == empty) return none;
+      i = (i + 1) & mask;
+    }
+    return slots[i].first;
+  }
+
+  // the next pattern with the same hash as pattern "id", or "none"
+  uint32_t next(const uint32_t id) const {return same[id];}
+
+private:
+  // no hash can be this, as q is less than 2^61
+  static const uint64_t empty = ~uint64_t(0);
+  struct slot {
+    uint64_t key;
+    uint32_t first;
+  };
+  // the hash of a short pattern is just its letters as a number in
+  // base d, so the slot and the bit of the filter are from the top
+  // bits of this product, which depend on all of its bits
+  static uint64_t spread(const uint64_t t) {return t*0x9e3779b97f4a7c15ull;}
+  vector<slot> slots;
+  size_t mask;
+  size_t shift;
+  vector<uint32_t> same;
+  vector<uint64_t> filter;
+  size_t filter_shift;
+};
+
+
+template<class Hash>
+fingerprint_table::fingerprint_table(const vector<string> &P, const Hash &H) :
+  same(P.size(), none) {
+  size_t bits = 1;
+  while ((1ul << bits) < 2*P.size())
+    ++bits;
+  const slot empty_slot = {empty, none};
+  slots.resize(1ul << bits, empty_slot);
+  mask = slots.size() - 1;
+  shift = 64 - bits;
+  size_t filter_bits = 6;
+  while ((1ul << filter_bits) < 32*P.size())
+    ++filter_bits;
+  filter.resize((1ul << filter_bits)/64, 0);
+  filter_shift = 64 - filter_bits;
+  // from the last, so each list is in the order of the patterns
+  for (size_t id = P.size(); id-- > 0;) {
+    size_t p = 0;
+    for (size_t j = 0; j < P[id].size(); ++j)
+      p = H.push(p, P[id][j]);
+    const size_t b = spread(p) >> filter_shift;
+    filter[b >> 6] |= uint64_t(1) << (b & 63);
+    size_t i = spread(p) >> shift;
+    while (slots[i].key != p && slots[i].key != empty)
+      i = (i + 1) & mask;
+    if (slots[i].key == p)
+      same[id] = slots[i].first;
+    slots[i].key = p;
+    slots[i].first = id;
+  }
 }
 
 
-static void
-read_fasta_as_one_sequence(const string &fasta_filename, string &T) {
-  T.clear(); // start with empty string
+// The patterns of one length, for Rabin_Karp_set: the arithmetic for
+// hashes of that length, the table of their hashes, the number of each
+// in the list of all patterns, and the hash of the last window of the
+// text with that length.
+template<class Hash> struct length_bucket {
+  length_bucket(const size_t n, const Hash &H, const vector<string> &P,
+                const vector<uint32_t> &ids) :
+    n(n), H(H), F(P, H), ids(ids), t(0) {}
+  size_t n;
+  Hash H;
+  fingerprint_table F;
+  vector<uint32_t> ids;
+  size_t t;
+};
 
-  const size_t filesize = get_filesize(fasta_filename);
 
-  // using "C" functions to read in the input because on my Mac there
-  // is a problem with reading large files using a single "read"
-  // function call when using C++ streams. This problem might be fixed
-  // in some compilers, but I've seen it in multiple.
-  FILE *in = fopen(fasta_filename.c_str(), "rb");
-  if (!in)
-    throw runtime_error("problem with file: " + fasta_filename);
+// check pattern P at position s, with the letters from the ring
+template<class Ring> static bool
+verify_ring(const Ring &ring, const size_t mask, const size_t s,
+            const string &P) {
+  for (size_t j = 0; j < P.size(); ++j) {
+    const char c = ring[(s + j) & mask];
+    if (c == fasta_separator || P[j] != encode_base(c)) return false;
+  }
+  return true;
+}
 
-  T.resize(filesize); // change *size*, not capacity of T here
 
-  if (fread((char*)&T[0], 1, filesize, in) != filesize)
-    throw runtime_error("problem with file: " + fasta_filename);
+// The same as Rabin_Karp for all the patterns P at once, which have
+// the lengths of the buckets in B, in increasing order. There is a
+// rolling hash for each length, and all of them are moved along the
+// text in the same loop, which reads each letter once. The last
+// letters read are kept in a ring, from which each hash takes the
+// letter that leaves its window, and where the hits are verified. A
+// match of pattern p at position s goes to the sink as sink(s, p), in
+// the order of where the matches end.
+template<class Text, class Hash, class Sink> static size_t
+Rabin_Karp_set(const Text &T, const vector<string> &P,
+               vector<length_bucket<Hash> > &B, Sink &&sink) {
 
-  if (fclose(in) != 0)
-    throw runtime_error("problem with file: " + fasta_filename);
+  const size_t m = T.size();
 
-  // remove the sequence names from the FASTA format string, along
-  // with the newline characters, what remains should be just DNA
-  // bases (maybe with a few random IUPAC degenerate nucleotides)
-  remove_names_newlines(T);
+  size_t ring_size = 1;
+  while (ring_size < B.back().n + 1)
+    ring_size <<= 1;
+  const size_t mask = ring_size - 1;
+  vector<char> ring(ring_size, 0);
+
+  typename Text::cursor lead(T, 0);
+
+  size_t hit_counter = 0;
+
+  for (size_t i = 0; i < m; ++i) {
+    const char c = lead.next();
+    ring[i & mask] = c;
+    const size_t in = encode_base(c);
+    for (size_t b = 0; b < B.size(); ++b) {
+      length_bucket<Hash> &L = B[b];
+      if (i < L.n) { // the first window is not complete
+        L.t = L.H.push(L.t, in);
+        if (i + 1 < L.n) continue;
+      }
+      else L.t = L.H.roll(L.t, encode_base(ring[(i - L.n) & mask]), in);
+      const size_t s = i + 1 - L.n;
+      for (uint32_t id = L.F.find(L.t); id != fingerprint_table::none;
+           id = L.F.next(id)) {
+        ++hit_counter;
+        const uint32_t p = L.ids[id];
+        if (verify_ring(ring, mask, s, P[p]))
+          sink(s, p);
+      }
+    }
+  }
+  return hit_counter;
 }
 
+
+// A search of the windows starting in [first, last) for search_parts,
+// with the plain Rabin-Karp and the arithmetic H, or with the lanes
+template<class Text, class Hash, class Verify> struct hash_scan {
+  template<class Sink> size_t
+  operator()(const size_t first, const size_t last, Sink &sink) const {
+    return Rabin_Karp(T, P, P_rc, H, verify, sink, first, last);
+  }
+  const Text &T;
+  const string &P;
+  const string &P_rc;
+  Hash H;
+  Verify verify;
+};
+
+template<class Text, class Hash, class Verify>
+static hash_scan<Text, Hash, Verify>
+make_hash_scan(const Text &T, const string &P, const string &P_rc,
+               const Hash &H, Verify verify) {
+  const hash_scan<Text, Hash, Verify> scan = {T, P, P_rc, H, verify};
+  return scan;
+}
+
+
+template<class Text, class Verify> struct lanes_scan {
+  template<class Sink> size_t
+  operator()(const size_t first, const size_t last, Sink &sink) const {
+    return Rabin_Karp_lanes(T, P, P_rc, d, verify, sink, level, first, last);
+  }
+  const Text &T;
+  const string &P;
+  const string &P_rc;
+  size_t d;
+  Verify verify;
+  rk_simd_level level;
+};
+
+template<class Text, class Verify> static lanes_scan<Text, Verify>
+make_lanes_scan(const Text &T, const string &P, const string &P_rc,
+                const size_t d, Verify verify, const rk_simd_level level) {
+  const lanes_scan<Text, Verify> scan = {T, P, P_rc, d, verify, level};
+  return scan;
+}
+
+
+// ADS: with threads the windows are split into parts, one for each
+// thread (see text_parts.hpp), and each part is searched on its own:
+// the hash of its first window takes n steps, like the hash of the
+// pattern, so no part needs the hash from the end of the one before.
+// To count, each thread has its own count_sink, and the hits and the
+// counts are added at the end. To print, the matches of each part are
+// kept, and written in order when all the parts are done; with one
+// thread they are written as they are found, and none are kept.
+template<class Text, class Scan> static size_t
+search_parts(const Text &T, const size_t n, const Scan &scan,
+             const bool print_matches, const size_t n_threads,
+             size_t &hit_counter) {
+  hit_counter = 0;
+  // a pattern longer than the text has no windows, and no matches
+  if (n > T.size())
+    return 0;
+  const size_t n_starts = T.size() - n + 1;
+  const size_t n_parts = n_text_parts(n_starts, n_threads);
+  vector<size_t> hits(n_parts, 0);
+
+  if (print_matches) {
+    match_writer out;
+    writer_sink writer(out, T.records(), n);
+    if (n_parts == 1)
+      hit_counter = scan(0, n_starts, writer);
+    else {
+      vector<position_sink> found(n_parts);
+      run_parts(n_parts, [&](const size_t t) {
+        hits[t] = scan(t*n_starts/n_parts, (t + 1)*n_starts/n_parts,
+                       found[t]);
+      });
+      for (size_t t = 0; t < n_parts; ++t) {
+        hit_counter += hits[t];
+        const position_sink &f = found[t];
+        for (size_t i = 0; i < f.matches.size(); ++i)
+          writer(f.matches[i], f.strands.empty() ? no_match : f.strands[i]);
+      }
+    }
+    out.flush();
+    return writer.count();
+  }
+
+  vector<count_sink> counters(n_parts);
+  run_parts(n_parts, [&](const size_t t) {
+    hits[t] = scan(t*n_starts/n_parts, (t + 1)*n_starts/n_parts,
+                   counters[t]);
+  });
+  size_t n_matches = 0;
+  for (size_t t = 0; t < n_parts; ++t) {
+    hit_counter += hits[t];
+    n_matches += counters[t].count();
+  }
+  return n_matches;
+}
+
+
+// the hash modulo q, or modulo 2^61 - 1 if "mersenne", and with the
+// lanes if "lanes" and the CPU has them, giving the number of matches
+template<class Text, class Verify> static size_t
+search_text(const Text &T, const string &P, const string &P_rc,
+            const size_t d, const size_t q, const bool mersenne,
+            const bool lanes, Verify verify, const bool print_matches,
+            const size_t n_threads, size_t &hit_counter) {
+  const size_t n = P.size();
+  const rk_simd_level level = rk_select_level();
+  if (lanes && level != rk_plain && d < 8)
+    return search_parts(T, n, make_lanes_scan(T, P, P_rc, d, verify, level),
+                        print_matches, n_threads, hit_counter);
+  if (mersenne)
+    return search_parts(T, n, make_hash_scan(T, P, P_rc, mod_mersenne(d, n),
+                                             verify),
+                        print_matches, n_threads, hit_counter);
+  return search_parts(T, n, make_hash_scan(T, P, P_rc, mod_prime(d, q, n),
+                                           verify),
+                      print_matches, n_threads, hit_counter);
+}
+
+
+// The patterns in a file, encoded, and their names
+static void
+read_pattern_set(const string &filename, vector<string> &P,
+                 vector<string> &names) {
+  vector<batch_pattern> patterns;
+  read_patterns(filename, patterns);
+  if (patterns.empty())
+    throw runtime_error("no patterns in " + filename);
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    string enc(patterns[i].seq);
+    for (size_t j = 0; j < enc.size(); ++j)
+      enc[j] = encode_base(enc[j]);
+    P.push_back(enc);
+    names.push_back(patterns[i].name);
+  }
+}
+
+
+// Search for all the (encoded) patterns P at once, printing each
+// match with the name of its pattern, or only counting them, and give
+// the number of matches of each pattern. The patterns have the
+// lengths in "lengths" (each once, in increasing order), and H[i] is
+// the arithmetic for hashes of length lengths[i].
+template<class Text, class Hash> static vector<size_t>
+search_set_hash(const Text &T, const vector<string> &P,
+                const vector<string> &names, const vector<size_t> &lengths,
+                const vector<Hash> &H, const bool print_matches,
+                size_t &hit_counter) {
+  vector<length_bucket<Hash> > B;
+  for (size_t i = 0; i < lengths.size(); ++i) {
+    vector<string> P_n;
+    vector<uint32_t> ids;
+    for (size_t p = 0; p < P.size(); ++p)
+      if (P[p].size() == lengths[i]) {
+        P_n.push_back(P[p]);
+        ids.push_back(p);
+      }
+    B.push_back(length_bucket<Hash>(lengths[i], H[i], P_n, ids));
+  }
+  if (print_matches) {
+    match_writer out;
+    vector<size_t> pattern_lengths;
+    for (size_t p = 0; p < P.size(); ++p)
+      pattern_lengths.push_back(P[p].size());
+    patterns_writer_sink writer(out, T.records(), pattern_lengths, names);
+    hit_counter = Rabin_Karp_set(T, P, B, writer);
+    out.flush();
+    return writer.counts;
+  }
+  histogram_sink counter(P.size());
+  hit_counter = Rabin_Karp_set(T, P, B, counter);
+  return counter.counts;
+}
+
+
+template<class Text> static vector<size_t>
+search_set(const Text &T, const vector<string> &P,
+           const vector<string> &names, const size_t d, const size_t q,
+           const bool mersenne, const bool print_matches,
+           size_t &hit_counter) {
+  vector<size_t> lengths;
+  for (size_t p = 0; p < P.size(); ++p)
+    lengths.push_back(P[p].size());
+  std::sort(begin(lengths), end(lengths));
+  lengths.erase(std::unique(begin(lengths), end(lengths)), end(lengths));
+
+  if (mersenne) {
+    vector<mod_mersenne> H;
+    for (size_t i = 0; i < lengths.size(); ++i)
+      H.push_back(mod_mersenne(d, lengths[i]));
+    return search_set_hash(T, P, names, lengths, H, print_matches,
+                           hit_counter);
+  }
+  vector<mod_prime> H;
+  for (size_t i = 0; i < lengths.size(); ++i)
+    H.push_back(mod_prime(d, q, lengths[i]));
+  return search_set_hash(T, P, names, lengths, H, print_matches,
+                         hit_counter);
+}
+
+
 int
-main(int argc, const char * const argv[]) {
+main(int argc, char * const argv[]) {
 
   static const size_t d = 5; // using an alphabet size of 5 for the
                              // 'N' in the genome
@@ -201,36 +710,187 @@ main(int argc, const char * const argv[]) {
   // 573292817ul
   // 3209ul
 
-  if (argc != 3) {
-    std::cerr << "usage: " << argv[0] << " <pattern> <FASTA-file>" << endl;
-    return EXIT_FAILURE;
+  // with "-p" print each match as a sequence name and offset; with
+  // "-2" pack the text into 2 bits per base before searching it; with
+  // "--region" (or "-r") and "--seqs" read only those parts of the
+  // file; with "-R" also search for the reverse complement; with "-M"
+  // use the hash modulo 2^61 - 1 instead of q; with "-V" also move 8
+  // or 16 of those hashes along the text at once with SIMD; with "-t"
+  // split the text into parts searched on that many threads; with "-f"
+  // search for all the patterns in a file at once
+  bool print_matches = false;
+  bool packed = false;
+  bool both_strands = false;
+  bool mersenne = false;
+  bool lanes = false;
+  size_t n_threads = 1;
+  vector<string> regions;
+  string patterns_file;
+  static const struct option long_options[] = {
+    {"region", required_argument, nullptr, 'r'},
+    {"seqs", required_argument, nullptr, 'S'},
+    {nullptr, 0, nullptr, 0}
+  };
+  static const char usage[] = " [-p] [-2] [-R] [-M] [-V] [-t threads] [--region name:start-end] "
+    "[--seqs name,...] <pattern> <FASTA-file>\n"
+    "   or: rabin-karp [options] -f <patterns-file> <FASTA-file>";
+  int opt;
+  while ((opt = getopt_long(argc, argv, "p2RMVt:f:r:", long_options, nullptr)) != -1) {
+    if (opt == 'p')
+      print_matches = true;
+    else if (opt == '2')
+      packed = true;
+    else if (opt == 'R')
+      both_strands = true;
+    else if (opt == 'M')
+      mersenne = true;
+    else if (opt == 'V')
+      mersenne = lanes = true;
+    else if (opt == 't')
+      n_threads = std::strtoul(optarg, nullptr, 10);
+    else if (opt == 'f')
+      patterns_file = optarg;
+    else if (opt == 'r')
+      regions.push_back(optarg);
+    else if (opt == 'S')
+      split_fasta_names(optarg, regions);
+    else {
+      std::cerr << "usage: " << argv[0] << usage << endl;
+      return EXIT_FAILURE;
+    }
   }
 
-  const string filename(argv[2]);
-
-  string P(argv[1]);
-  string T;
-  read_fasta_as_one_sequence(filename, T);
-
-  // make sure pattern not bigger than text
-  assert(P.size() <= T.size());
-
-  // convert the pattern and text into their numerical values
-  for (size_t i = 0; i < P.size(); ++i)
-    P[i] = encode_base(P[i]);
-
-  for (size_t i = 0; i < T.size(); ++i)
-    T[i] = encode_base(T[i]);
+  if (!patterns_file.empty()) {
+    if (argc - optind != 1 || both_strands || lanes || n_threads > 1) {
+      std::cerr << "usage: " << argv[0] << usage << endl;
+      return EXIT_FAILURE;
+    }
+    try {
+      vector<string> P, names;
+      read_pattern_set(patterns_file, P, names);
+      const string filename(argv[optind]);
+      vector<size_t> counts;
+      size_t hit_counter = 0;
+      size_t text_size = 0;
+      if (!regions.empty()) {
+        const fasta_index index(filename);
+        const fasta_subset T(filename, index, index.parse_regions(regions));
+        text_size = T.size();
+        counts = search_set(T, P, names, d, q, mersenne, print_matches,
+                            hit_counter);
+      }
+      else if (packed || use_genome_cache(filename)) {
+        const packed_genome G(filename);
+        text_size = G.text().size();
+        counts = search_set(G.text(), P, names, d, q, mersenne,
+                            print_matches, hit_counter);
+      }
+      else {
+        const fasta_mmap T(filename);
+        text_size = T.size();
+        counts = search_set(T, P, names, d, q, mersenne, print_matches,
+                            hit_counter);
+      }
+      // the number of matches of each pattern, and of all of them
+      size_t n_matches = 0;
+      for (size_t i = 0; i < P.size(); ++i) {
+        cout << names[i] << '\t' << counts[i] << '\n';
+        n_matches += counts[i];
+      }
+      cout << "match count:\t" << n_matches << endl
+           << "hits:\t" << hit_counter << endl
+           << "hit rate:\t"
+           << static_cast<double>(hit_counter)/text_size << endl;
+    }
+    catch (std::exception &e) {
+      std::cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
 
-  // run the actual algorithm
-  vector<size_t> matches;
-  const size_t hit_counter = Rabin_Karp(T, P, d, q, matches);
+  if (argc - optind != 2) {
+    std::cerr << "usage: " << argv[0] << usage << endl;
+    return EXIT_FAILURE;
+  }
 
-  // output the number of matches
-  cout << "match count:\t" << matches.size() << endl
-       << "hits:\t" << hit_counter << endl
-       << "hit rate:\t"
-       << static_cast<double>(hit_counter)/T.size() << endl;
+  try {
+    const string filename(argv[optind + 1]);
+
+    // the letters of the pattern are kept for the packed form
+    const string pattern(argv[optind]);
+    string P(pattern);
+
+    const packed_dna packed_P(pattern);
+
+    // the reverse complement, searched in the same pass with "-R"
+    const string pattern_rc(both_strands ?
+                            fasta_reverse_complement(pattern) : "");
+    string P_rc(pattern_rc);
+    const packed_dna packed_P_rc(pattern_rc);
+
+    // convert the pattern into its numerical values; the text is
+    // converted as it is scanned
+    for (size_t i = 0; i < P.size(); ++i)
+      P[i] = encode_base(P[i]);
+    for (size_t i = 0; i < P_rc.size(); ++i)
+      P_rc[i] = encode_base(P_rc[i]);
+
+    // run the actual algorithm
+    size_t n_matches = 0;
+    size_t hit_counter = 0;
+    size_t text_size = 0;
+    if (!regions.empty()) {
+      // only the bytes of the regions are read, using the ".fai" index
+      const fasta_index index(filename);
+      const fasta_subset T(filename, index, index.parse_regions(regions));
+      text_size = T.size();
+
+      n_matches =
+        search_text(T, P, P_rc, d, q, mersenne, lanes,
+                    [&](size_t, const fasta_subset::cursor &trail,
+                        const bool rc) {
+                      return verify_window(trail, rc ? P_rc : P);
+                    }, print_matches, n_threads, hit_counter);
+    }
+    else if (packed || use_genome_cache(filename)) {
+      // packed now, or taken from the cache made by compile_reference;
+      // a hit is verified 32 bases at a time with "equal"
+      const packed_genome G(filename);
+      const packed_dna &packed_T = G.text();
+      text_size = packed_T.size();
+
+      n_matches =
+        search_text(packed_T, P, P_rc, d, q, mersenne, lanes,
+                    [&](const size_t s, const packed_dna::cursor &,
+                        const bool rc) {
+                      return packed_T.equal(s, rc ? packed_P_rc : packed_P);
+                    }, print_matches, n_threads, hit_counter);
+    }
+    else {
+      // map the FASTA file; the names and newlines are skipped while
+      // reading, so what we see should be just DNA bases (maybe with a
+      // few random IUPAC degenerate nucleotides)
+      const fasta_mmap T(filename);
+      text_size = T.size();
+
+      n_matches =
+        search_text(T, P, P_rc, d, q, mersenne, lanes,
+                    [&](size_t, const fasta_mmap::cursor &trail,
+                        const bool rc) {
+                      return verify_window(trail, rc ? P_rc : P);
+                    }, print_matches, n_threads, hit_counter);
+    }
 
+    // output the number of matches
+    cout << "match count:\t" << n_matches << endl
+         << "hits:\t" << hit_counter << endl
+         << "hit rate:\t"
+         << static_cast<double>(hit_counter)/text_size << endl;
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,284 @@
+/* rabin_karp_simd: the rolling hash of Rabin-Karp modulo 2^61 - 1 for
+ * 8 or 16 parts of the text at once with SIMD instructions.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: each new hash in Rabin-Karp needs the one before it, so the
+// time for each position is the time for a multiply, an add and a
+// remainder one after another, even though the CPU could do several
+// of these at the same time. Here the text is split into parts, and
+// each part has its own hash, in a "lane" of a SIMD register, so one
+// instruction moves 4 or 8 hashes along, and two registers are used
+// so one can start while the other finishes. That is 8 lanes with
+// AVX2 and 16 with AVX-512.
+//
+// The letters are given as codes (0 to 4) in rows: row k has letter k
+// of each lane, one byte per lane, so the letters for all the lanes
+// at one step are next to each other. The hash is modulo q = 2^61 - 1
+// as in mod_mersenne (rabin-karp.cpp), but without 128-bit products,
+// which SIMD does not have: the base d must be less than 8, so that
+// the numbers stay in 64 bits, and the products are of 32-bit halves.
+//
+// The step for a lane with hash t, the letter "out" leaving the window
+// and "in" entering it, with h = d^(n-1) modulo q:
+//
+//   u = t + 4q - out*h      (out <= 4, so this is positive)
+//   u = (u & q) + (u >> 61) (the same modulo q, and less than 2^61 + 5)
+//   x = u*d + in            (less than 2^64, as d < 8)
+//   t = (x & q) + (x >> 61), then minus q if it is at least q
+//
+// Starting from t = 0 with "out" of 0 for the first n steps gives the
+// hash of the first window, so there is no separate start for a lane.
+//
+// The widest instructions the CPU has are picked when the program
+// runs, as in naive_simd.hpp. Without AVX2 there are no lanes, and the
+// search should use the plain Rabin-Karp.
+
+#ifndef RABIN_KARP_SIMD_HPP
+#define RABIN_KARP_SIMD_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__GNUC__) || defined(__clang__))
+#define RABIN_KARP_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// The numbers the lanes need for one pattern of length n, and the
+// hash of the pattern (p) and of its reverse complement (p_rc), if
+// that is also searched for (otherwise "search_rc" is false).
+struct rk_lane_consts {
+  static const uint64_t q = (uint64_t(1) << 61) - 1;
+  rk_lane_consts(const uint64_t d, const size_t n, const uint64_t p,
+                 const uint64_t p_rc, const bool search_rc) :
+    d(d), p(p), p_rc(p_rc), search_rc(search_rc) {
+    h = 1;
+    for (size_t i = 1; i < n; ++i)
+      h = reduce_small(h*d);
+  }
+  // h*d < 2^64 for h < q and d < 8
+  static uint64_t reduce_small(const uint64_t x) {
+    const uint64_t r = (x & q) + (x >> 61);
+    return r >= q ? r - q : r;
+  }
+  uint64_t d;
+  uint64_t h;
+  uint64_t p;
+  uint64_t p_rc;
+  bool search_rc;
+};
+
+
+#ifdef RABIN_KARP_SIMD_X86
+
+// One step for 4 lanes; "o" and "i" are the codes out and in
+__attribute__((target("avx2"))) static inline __m256i
+rk_step_avx2(__m256i t, const __m256i o, const __m256i i,
+             const __m256i h_lo, const __m256i h_hi, const __m256i d,
+             const __m256i q, const __m256i q4) {
+  const __m256i oh =
+    _mm256_add_epi64(_mm256_mul_epu32(o, h_lo),
+                     _mm256_slli_epi64(_mm256_mul_epu32(o, h_hi), 32));
+  __m256i u = _mm256_sub_epi64(_mm256_add_epi64(t, q4), oh);
+  u = _mm256_add_epi64(_mm256_and_si256(u, q), _mm256_srli_epi64(u, 61));
+  const __m256i x =
+    _mm256_add_epi64(
+      _mm256_add_epi64(_mm256_mul_epu32(u, d),
+                       _mm256_slli_epi64(
+                         _mm256_mul_epu32(_mm256_srli_epi64(u, 32), d), 32)),
+      i);
+  t = _mm256_add_epi64(_mm256_and_si256(x, q), _mm256_srli_epi64(x, 61));
+  // all are less than 2^63, so the signed compare is right
+  return _mm256_sub_epi64(t, _mm256_andnot_si256(_mm256_cmpgt_epi64(q, t), q));
+}
+
+
+// the lanes of t equal to p, as bits
+__attribute__((target("avx2"))) static inline uint32_t
+rk_equal_avx2(const __m256i t, const __m256i p) {
+  return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(t, p)));
+}
+
+
+// Moves 8 lanes through rows [0, n_rows - n] of the codes, where the
+// row k + n is "in" and row k is "out". At each step k from n - 1 the
+// hash of a lane is that of its window ending at row k + n, and a hash
+// equal to that of the pattern gives hit(k, lane, false), or with the
+// reverse complement hit(k, lane, true).
+template<class Hit> __attribute__((target("avx2"))) static inline void
+rk_lanes_avx2(const uint8_t *codes, const size_t n, const size_t n_rows,
+              const rk_lane_consts &c, Hit &hit) {
+  static const size_t L = 8;
+  const __m256i q = _mm256_set1_epi64x(c.q);
+  const __m256i q4 = _mm256_set1_epi64x(4*c.q);
+  const __m256i h_lo = _mm256_set1_epi64x(c.h & 0xffffffffu);
+  const __m256i h_hi = _mm256_set1_epi64x(c.h >> 32);
+  const __m256i d = _mm256_set1_epi64x(c.d);
+  const __m256i p = _mm256_set1_epi64x(c.p);
+  const __m256i p_rc = _mm256_set1_epi64x(c.p_rc);
+  __m256i t0 = _mm256_setzero_si256();
+  __m256i t1 = _mm256_setzero_si256();
+  for (size_t k = 0; k + n < n_rows; ++k) {
+    const uint8_t *o = codes + k*L;
+    const uint8_t *i = codes + (k + n)*L;
+    int32_t o0, o1, i0, i1;
+    std::memcpy(&o0, o, 4);
+    std::memcpy(&o1, o + 4, 4);
+    std::memcpy(&i0, i, 4);
+    std::memcpy(&i1, i + 4, 4);
+    t0 = rk_step_avx2(t0, _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(o0)),
+                      _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(i0)),
+                      h_lo, h_hi, d, q, q4);
+    t1 = rk_step_avx2(t1, _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(o1)),
+                      _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(i1)),
+                      h_lo, h_hi, d, q, q4);
+    if (k + 1 < n) continue;
+    uint32_t fwd = rk_equal_avx2(t0, p) | (rk_equal_avx2(t1, p) << 4);
+    uint32_t rev = !c.search_rc ? 0 :
+      rk_equal_avx2(t0, p_rc) | (rk_equal_avx2(t1, p_rc) << 4);
+    while ((fwd | rev) != 0) {
+      // in order of lane, and forward first in a lane
+      const uint32_t lane = __builtin_ctz(fwd | rev);
+      if (fwd & (1u << lane)) hit(k, lane, false);
+      if (rev & (1u << lane)) hit(k, lane, true);
+      fwd &= ~(1u << lane);
+      rev &= ~(1u << lane);
+    }
+  }
+}
+
+
+// GCC 12 warns about the "undefined" vectors in its own AVX-512
+// header, which are not a problem
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// the same for 8 lanes of a 512-bit register
+__attribute__((target("avx512f"))) static inline __m512i
+rk_step_avx512(__m512i t, const __m512i o, const __m512i i,
+               const __m512i h_lo, const __m512i h_hi, const __m512i d,
+               const __m512i q, const __m512i q4) {
+  const __m512i oh =
+    _mm512_add_epi64(_mm512_mul_epu32(o, h_lo),
+                     _mm512_slli_epi64(_mm512_mul_epu32(o, h_hi), 32));
+  __m512i u = _mm512_sub_epi64(_mm512_add_epi64(t, q4), oh);
+  u = _mm512_add_epi64(_mm512_and_si512(u, q), _mm512_srli_epi64(u, 61));
+  const __m512i x =
+    _mm512_add_epi64(
+      _mm512_add_epi64(_mm512_mul_epu32(u, d),
+                       _mm512_slli_epi64(
+                         _mm512_mul_epu32(_mm512_srli_epi64(u, 32), d), 32)),
+      i);
+  t = _mm512_add_epi64(_mm512_and_si512(x, q), _mm512_srli_epi64(x, 61));
+  // t - q wraps to a large number if t < q
+  return _mm512_min_epu64(t, _mm512_sub_epi64(t, q));
+}
+
+
+// as rk_lanes_avx2, with 16 lanes
+template<class Hit> __attribute__((target("avx512f"))) static inline void
+rk_lanes_avx512(const uint8_t *codes, const size_t n, const size_t n_rows,
+                const rk_lane_consts &c, Hit &hit) {
+  static const size_t L = 16;
+  const __m512i q = _mm512_set1_epi64(c.q);
+  const __m512i q4 = _mm512_set1_epi64(4*c.q);
+  const __m512i h_lo = _mm512_set1_epi64(c.h & 0xffffffffu);
+  const __m512i h_hi = _mm512_set1_epi64(c.h >> 32);
+  const __m512i d = _mm512_set1_epi64(c.d);
+  const __m512i p = _mm512_set1_epi64(c.p);
+  const __m512i p_rc = _mm512_set1_epi64(c.p_rc);
+  __m512i t0 = _mm512_setzero_si512();
+  __m512i t1 = _mm512_setzero_si512();
+  for (size_t k = 0; k + n < n_rows; ++k) {
+    const __m128i o =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + k*L));
+    const __m128i i =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + (k + n)*L));
+    t0 = rk_step_avx512(t0, _mm512_cvtepu8_epi64(o), _mm512_cvtepu8_epi64(i),
+                        h_lo, h_hi, d, q, q4);
+    t1 = rk_step_avx512(t1, _mm512_cvtepu8_epi64(_mm_srli_si128(o, 8)),
+                        _mm512_cvtepu8_epi64(_mm_srli_si128(i, 8)),
+                        h_lo, h_hi, d, q, q4);
+    if (k + 1 < n) continue;
+    uint32_t fwd = _mm512_cmpeq_epi64_mask(t0, p) |
+      (uint32_t(_mm512_cmpeq_epi64_mask(t1, p)) << 8);
+    uint32_t rev = !c.search_rc ? 0 :
+      (_mm512_cmpeq_epi64_mask(t0, p_rc) |
+       (uint32_t(_mm512_cmpeq_epi64_mask(t1, p_rc)) << 8));
+    while ((fwd | rev) != 0) {
+      const uint32_t lane = __builtin_ctz(fwd | rev);
+      if (fwd & (1u << lane)) hit(k, lane, false);
+      if (rev & (1u << lane)) hit(k, lane, true);
+      fwd &= ~(1u << lane);
+      rev &= ~(1u << lane);
+    }
+  }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+
+enum rk_simd_level {rk_plain, rk_avx2, rk_avx512};
+
+// the widest instructions the CPU can run, found once
+static inline rk_simd_level
+rk_select_level() {
+#ifdef RABIN_KARP_SIMD_X86
+  static const rk_simd_level level = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return rk_avx512;
+    if (__builtin_cpu_supports("avx2")) return rk_avx2;
+    return rk_plain;
+  }();
+  return level;
+#else
+  return rk_plain;
+#endif
+}
+
+
+// the number of lanes, or 0 if there are none
+static inline size_t
+rk_simd_lanes(const rk_simd_level level) {
+  return level == rk_avx512 ? 16 : (level == rk_avx2 ? 8 : 0);
+}
+
+
+// The lanes for rows of codes with rk_simd_lanes(level) bytes each (see
+// rk_lanes_avx2); does nothing for rk_plain
+template<class Hit> static inline void
+rk_lanes(const uint8_t *codes, const size_t n, const size_t n_rows,
+         const rk_lane_consts &c, Hit &hit, const rk_simd_level level) {
+#ifdef RABIN_KARP_SIMD_X86
+  if (level == rk_avx512)
+    rk_lanes_avx512(codes, n, n_rows, c, hit);
+  else if (level == rk_avx2)
+    rk_lanes_avx2(codes, n, n_rows, c, hit);
+#else
+  (void)codes; (void)n; (void)n_rows; (void)c; (void)hit; (void)level;
+#endif
+}
+
+#endif
@@ -0,0 +1,110 @@
+#!/usr/bin/env bash
+#
+# rabin_karp_vs_aho.sh: time "rabin-karp -f" and aho_corasick on the
+# same patterns and text, and check they find the same matches.
+#
+# Copyright (C) 2024 Andrew D. Smith
+#
+# Authors: Andrew D. Smith
+#
+# This program is free software: you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+
+# ADS: run this from the "src" directory after compiling both programs:
+#
+# $ c++ -O3 -o rabin-karp rabin-karp.cpp -lz -pthread
+# $ make -C aho_corasick
+# $ ./rabin_karp_vs_aho.sh probes.fa genome.fa
+#
+# Any options after the two files are given to rabin-karp (the default
+# is "-M"). The aho_corasick program searches only the first sequence,
+# and reads any letter other than A, C, G and T (after upper case) as
+# 'A', so both programs are given the same text made from the first
+# sequence: in upper case, with any other letter (e.g. N) made 'A'.
+# Patterns with such letters are left out, as the two programs would
+# not be searching for the same thing, and the number left out is
+# printed. These files are made first and not timed. The number of
+# matches of each pattern must be the same for both, or this fails.
+
+set -e
+
+if [[ $# -lt 2 ]]; then
+    echo "usage: $0 <patterns-file> <FASTA-file> [rabin-karp options]" >&2
+    exit 1
+fi
+
+patterns=$1
+fasta=$2
+shift 2
+rk_options=("$@")
+if [[ ${#rk_options[@]} -eq 0 ]]; then
+    rk_options=(-M)
+fi
+
+rabin_karp=${RABIN_KARP:-./rabin-karp}
+aho_corasick=${AHO_CORASICK:-./aho_corasick/aho_corasick}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# the first sequence in upper case with only A, C, G and T, and the
+# patterns that have only those as FASTA (a pattern file without names
+# has each pattern as its name)
+awk '/^>/ {if (++n > 1) exit; print; next}
+     {s = toupper($0); gsub(/[^ACGT]/, "A", s); print s}' \
+    "$fasta" > "$tmp/text.fa"
+awk 'function put() {
+       if (name == "") return
+       if (seq ~ /^[ACGT]+$/) print ">" name "\n" seq
+       else ++left_out
+     }
+     /^#/ || NF == 0 {next}
+     /^>/ {put(); fasta = 1; name = substr($0, 2); seq = ""; next}
+     fasta {seq = seq toupper($0); next}
+     {put(); name = $1; seq = toupper(NF > 1 ? $2 : $1)}
+     END {
+       put()
+       if (left_out > 0)
+         print "left out " left_out " patterns with letters other " \
+           "than A, C, G and T" > "/dev/stderr"
+     }' "$patterns" > "$tmp/patterns.fa"
+
+# the seconds taken by a command, with its output in a file
+time_command() {
+    local out=$1
+    shift
+    local start end
+    start=$(date +%s.%N)
+    "$@" > "$out"
+    end=$(date +%s.%N)
+    awk -v s="$start" -v e="$end" 'BEGIN {printf "%.3f", e - s}'
+}
+
+rk_time=$(time_command "$tmp/rk.txt" \
+    "$rabin_karp" "${rk_options[@]}" -f "$tmp/patterns.fa" "$tmp/text.fa")
+ac_time=$(time_command "$tmp/ac.txt" \
+    "$aho_corasick" -c "$tmp/patterns.fa" "$tmp/text.fa")
+
+# both give "name<TAB>count" for each pattern, and then the totals
+grep -v -e '^match count:' -e '^hits:' -e '^hit rate:' "$tmp/rk.txt" |
+    sort > "$tmp/rk_counts.txt"
+head -n -1 "$tmp/ac.txt" | sort > "$tmp/ac_counts.txt"
+rk_matches=$(awk -F'\t' '{n += $2} END {print n + 0}' "$tmp/rk_counts.txt")
+ac_matches=$(awk -F'\t' '{n += $2} END {print n + 0}' "$tmp/ac_counts.txt")
+
+echo -e "search\tmatches\tseconds"
+echo -e "rabin-karp ${rk_options[*]}\t$rk_matches\t$rk_time"
+echo -e "aho_corasick\t$ac_matches\t$ac_time"
+
+if ! cmp -s "$tmp/rk_counts.txt" "$tmp/ac_counts.txt"; then
+    echo "the programs found different matches:" >&2
+    diff "$tmp/rk_counts.txt" "$tmp/ac_counts.txt" | head >&2
+    exit 1
+fi
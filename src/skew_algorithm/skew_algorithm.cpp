@@ -19,14 +19,20 @@
 /*
   ADS: I assume this is entirely C++11. You should be able to compile it like:
 
-  $ g++ -o skew_algorithm skew_algorithm.cpp
+  $ g++ -o skew_algorithm skew_algorithm.cpp -lz -pthread
 
   If your C++ compiler is older, then you might need something like:
 
-  $ g++ -std=c++11 -o skew_algorithm skew_algorithm.cpp
+  $ g++ -std=c++11 -o skew_algorithm skew_algorithm.cpp -lz -pthread
 */
 
 
+#include "../fasta_mmap.hpp"
+#include "../fasta_stream.hpp"
+#include "../packed_dna.hpp"
+#include "../genome_cache.hpp"
+#include "../fasta_index.hpp"
+
 #include <string>
 #include <vector>
 #include <iostream>
@@ -36,6 +42,9 @@
 #include <iterator>
 #include <numeric>
 
+#include <getopt.h>
+#include <sys/stat.h>
+
 using std::string;
 using std::vector;
 using std::cout;
@@ -59,9 +68,12 @@ leq_triple(const uint32_t a1, const uint32_t a2, const uint32_t a3,
 }
 
 
-static void
+// ADS: the keys are read as r[shift + a[i]], where "r" is the text
+// for this level of the recursion. At the top level the text might be
+// packed (see packed_skew_text below), so only "[]" is used on it.
+template<class Text> static void
 counting_sort(vector<uint32_t> &a, vector<uint32_t> &b,
-           vector<uint32_t>::const_iterator r, size_t n, size_t K) {
+              const Text &r, const size_t shift, size_t n, size_t K) {
 
   vector<uint32_t> c(K + 1, 0);
   const vector<uint32_t>::const_iterator a_beg = cbegin(a);
@@ -69,18 +81,18 @@ counting_sort(vector<uint32_t> &a, vector<uint32_t> &b,
 
   vector<uint32_t>::const_iterator a_itr = a_beg;
   for (; a_itr != a_lim; ++a_itr)
-    ++c[*(r + *a_itr)];
+    ++c[r[shift + *a_itr]];
 
   for (size_t i = 1; i <= K; i++)
     c[i] += c[i-1];
 
   while (a_itr != a_beg)
-    b[--c[*(r + *a_itr)]] = *(--a_itr);
+    b[--c[r[shift + *a_itr]]] = *(--a_itr);
 }
 
 
-static void
-skew(const vector<uint32_t> &s, vector<uint32_t> &SA, const size_t n, const size_t K) {
+template<class Text> static void
+skew(const Text &s, vector<uint32_t> &SA, const size_t n, const size_t K) {
 
   const size_t n0 = (n + 2)/3;  // mod0 suffixes
   const size_t n1 = (n + 1)/3;  // mod1 suffixes
@@ -98,11 +110,9 @@ skew(const vector<uint32_t> &s, vector<uint32_t> &SA, const size_t n, const size
   vector<uint32_t> SA12(n02 + 3, 0);
 
   // Together these counting sorts below form a radix sort on triples
-  counting_sort(s12, SA12, begin(s) + 2, n02, K);
-  counting_sort(SA12, s12, begin(s) + 1, n02, K);
-  counting_sort(s12, SA12, begin(s) + 0, n02, K);
-
-  const vector<uint32_t>::const_iterator sbeg = cbegin(s);
+  counting_sort(s12, SA12, s, 2, n02, K);
+  counting_sort(SA12, s12, s, 1, n02, K);
+  counting_sort(s12, SA12, s, 0, n02, K);
 
   // ADS: for the uint32_t below with value -1 it is actually the
   // wrapping to the largest value of a uint32_t
@@ -110,14 +120,14 @@ skew(const vector<uint32_t> &s, vector<uint32_t> &SA, const size_t n, const size
   uint32_t c0 = -1, c1 = -1, c2 = -1;
   const vector<uint32_t>::const_iterator lim = cbegin(SA12) + n02;
   for (vector<uint32_t>::const_iterator i = cbegin(SA12); i != lim; ++i) {
-    const vector<uint32_t>::const_iterator triplet_start = sbeg + *i;
-    if (*(triplet_start + 0) != c0 ||
-        *(triplet_start + 1) != c1 ||
-        *(triplet_start + 2) != c2) {
+    const size_t triplet_start = *i;
+    if (s[triplet_start + 0] != c0 ||
+        s[triplet_start + 1] != c1 ||
+        s[triplet_start + 2] != c2) {
       name++;
-      c0 = *(triplet_start + 0);
-      c1 = *(triplet_start + 1);
-      c2 = *(triplet_start + 2);
+      c0 = s[triplet_start + 0];
+      c1 = s[triplet_start + 1];
+      c2 = s[triplet_start + 2];
     }
     if (*i % 3 == 1)
       s12[*i/3] = name;
@@ -144,7 +154,7 @@ skew(const vector<uint32_t> &s, vector<uint32_t> &SA, const size_t n, const size
       s0[j++] = 3*SA12[i];
 
   vector<uint32_t> SA0(n0);
-  counting_sort(s0, SA0, begin(s), n0, K);
+  counting_sort(s0, SA0, s, 0, n0, K);
   s0.clear();
   s0.shrink_to_fit();
 
@@ -181,69 +191,111 @@ skew(const vector<uint32_t> &s, vector<uint32_t> &SA, const size_t n, const size
 }
 
 
-// Reads a FASTA format file line-by-line, skipping the "name" lines.
-// This function is not designed to read FASTA format files generally.
+// Reads a FASTA format file in blocks, and each block goes through the
+// normalizer (see fasta_normalize.hpp), which removes the "name"
+// lines and the ends of lines and encodes the bases in one pass, so
+// here we only need to widen the encoded bytes into the text. The
+// separator between sequences is encoded like any other non-ACGT
+// letter, and keeps the positions in the suffix array the same as
+// those in fasta_records.
 static vector<uint32_t>
 read_fasta_as_numbers(const string &fasta_filename) {
-  // see the Rabin-Karp source for more on this encoding
-  static constexpr char dna_encoding[] = {
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 1, 5, 2, 5, 5, 5, 3, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 1, 5, 2, 5, 5, 5, 3, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5
-  }; // note: there is no "0" in this encoding because we need it for
-     // our termination symbols and to ensure it is always preceding
-     // any other letter in any new alphabet
-
-  std::ifstream in(fasta_filename);
-  if (!in)
-    throw std::runtime_error("problem with file: " + fasta_filename);
+  // see the Rabin-Karp source for more on this encoding; there is no
+  // "0" in this encoding because we need it for our termination
+  // symbols and to ensure it is always preceding any other letter in
+  // any new alphabet
+  static const dna_codes codes = {1, 2, 3, 4, 5};
+
+  fasta_stream in(fasta_filename, fasta_stream::default_block_size, &codes);
 
-  // get the size of the file the pre-C++17 way: find the size of the
-  // file by moving to end, then finding the distance from the
-  // beginning
-  const std::streampos begin_pos = in.tellg();
-  in.seekg(0, std::ios_base::end);
-  const size_t filesize = in.tellg() - begin_pos;
-  in.seekg(0, std::ios_base::beg); // move back to the beginning
+  // reserve enough total space, including the 3 terminating zeros
+  struct stat st;
+  if (stat(fasta_filename.c_str(), &st) != 0)
+    throw std::runtime_error("problem with file: " + fasta_filename);
 
   vector<uint32_t> T;
-  T.reserve(filesize); // reserve enough total space
-
-  string line;
-  while (getline(in, line))
-    if (line[0] != '>') // don't do the "name" lines in FASTA
-      // the "transform" puts the current line into the text, while
-      // converting the letter to its numerical encoding
-      transform(begin(line), end(line), back_inserter(T),
-                [](const char c) {
-                  // cast to integer type to avoid compiler warning
-                  return dna_encoding[static_cast<uint32_t>(c)];
-                });
+  T.reserve(st.st_size + 3);
+
+  in.for_each_line([&](const char *piece, const size_t len, size_t) {
+    T.insert(end(T), piece, piece + len);
+  });
 
   // we may assume copy elision for any modern C++
   return T;
 }
 
 
+// The same numbers for only some regions of the file (see
+// fasta_index.hpp), which are the only bytes read from the file
+static vector<uint32_t>
+read_regions_as_numbers(const string &fasta_filename,
+                        const vector<string> &regions) {
+  const fasta_index index(fasta_filename);
+  const fasta_subset S(fasta_filename, index, index.parse_regions(regions));
+
+  vector<uint32_t> T(S.size());
+  for (size_t i = 0; i < S.size(); ++i)
+    switch (fasta_upper(S[i])) {
+    case 'A': T[i] = 1; break;
+    case 'C': T[i] = 2; break;
+    case 'G': T[i] = 3; break;
+    case 'T': T[i] = 4; break;
+    default: T[i] = 5; // including the separators
+    }
+  return T;
+}
+
+
+// The packed text (see packed_dna.hpp) seen as the same numbers that
+// read_fasta_as_numbers gives: 1 to 4 for ACGT, 5 for anything else,
+// and the 3 zeros at the end. This keeps 2 bits per base instead of
+// the 32 bits of the vector for the top level of the recursion.
+class packed_skew_text {
+public:
+  explicit packed_skew_text(const packed_dna &T) : T(T) {}
+  uint32_t operator[](const size_t i) const {
+    if (i >= T.size()) return 0;
+    return T.masked_in(i, 1) ? 5 : T.code(i) + 1;
+  }
+private:
+  const packed_dna &T;
+};
+
+
 int
-main(int argc, const char **argv) {
+main(int argc, char * const argv[]) {
 
   try {
 
     static const size_t initial_alphabet_size = 5;
 
-    if (argc != 3) {
-      cout << "usage: " << argv[0] << " <fasta-file> <outfile>" << endl;
+    // with "-2" the text is packed in 2 bits per base; with
+    // "--region" (or "-r") and "--seqs" only those parts of the file
+    // are used
+    bool packed = false;
+    vector<string> regions;
+    static const struct option long_options[] = {
+      {"region", required_argument, nullptr, 'r'},
+      {"seqs", required_argument, nullptr, 'S'},
+      {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "2r:", long_options, nullptr)) != -1)
+      if (opt == '2')
+        packed = true;
+      else if (opt == 'r')
+        regions.push_back(optarg);
+      else if (opt == 'S')
+        split_fasta_names(optarg, regions);
+
+    if (argc - optind != 2) {
+      cout << "usage: " << argv[0] << " [-2] [--region name:start-end] "
+           << "[--seqs name,...] <fasta-file> <outfile>" << endl;
       return EXIT_SUCCESS;
     }
 
-    const string filename(argv[1]);
-    const string outfile(argv[2]);
+    const string filename(argv[optind]);
+    const string outfile(argv[optind + 1]);
 
     /* opening the output stream in binary mode */
     // ADS: do this *now* in case it fails we won't have spent all the
@@ -260,19 +312,31 @@ main(int argc, const char **argv) {
     /* here I'm using a 32-bit unsigned: uint32_t */
     /* this is enough for the human genome (one strand) */
 
-    vector<uint32_t> T = read_fasta_as_numbers(filename);
-
-    // ADS: Adding 3 zeros because every triplet must be complete and
-    // a full triplet of 000 is needed in case (n = 1 mod 3) since,
-    // for any mod0, we need a mod12 that follows it. This will happen
-    // again recursively inside "skew".
-    const size_t n = T.size();
-    T.push_back(0);
-    T.push_back(0);
-    T.push_back(0);
-
     vector<uint32_t> SA;
-    skew(T, SA, n, initial_alphabet_size);
+
+    if (regions.empty() && (packed || use_genome_cache(filename))) {
+      // packed now, or from the cache made by compile_reference
+      const packed_genome G(filename);
+      const packed_dna &T = G.text();
+      // the 3 zeros at the end come from packed_skew_text
+      skew(packed_skew_text(T), SA, T.size(), initial_alphabet_size);
+    }
+    else {
+      vector<uint32_t> T = regions.empty() ?
+        read_fasta_as_numbers(filename) :
+        read_regions_as_numbers(filename, regions);
+
+      // ADS: Adding 3 zeros because every triplet must be complete and
+      // a full triplet of 000 is needed in case (n = 1 mod 3) since,
+      // for any mod0, we need a mod12 that follows it. This will happen
+      // again recursively inside "skew".
+      const size_t n = T.size();
+      T.push_back(0);
+      T.push_back(0);
+      T.push_back(0);
+
+      skew(T, SA, n, initial_alphabet_size);
+    }
 
     const size_t n_bytes_to_write = SA.size()*sizeof(uint32_t);
 
@@ -0,0 +1,78 @@
+/* text_parts: split the positions of a text into parts and search
+ * the parts on separate threads.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: a search with threads gives each thread the matches that start
+// in one part [first, last) of the positions of the text, where part
+// t of n_parts is [t*n_starts/n_parts, (t + 1)*n_starts/n_parts). A
+// thread reads up to |P| - 1 letters past "last", from the same text
+// as the others, so the matches that cross into the next part are
+// found, and each match is found by exactly one thread.
+
+#ifndef TEXT_PARTS_HPP
+#define TEXT_PARTS_HPP
+
+#include <vector>
+#include <thread>
+#include <functional>
+#include <system_error>
+#include <exception>
+#include <algorithm>
+
+// Run f(0), ..., f(n_parts - 1) at the same time, with the calling
+// thread doing part 0, and any part a thread could not be started for.
+// An exception from f in any part is kept until all the threads have
+// been joined, and then the first one is thrown from here, so it can
+// be caught by the caller like any other error.
+static void
+run_parts(const size_t n_parts, std::function<void(size_t)> f) {
+  std::vector<std::exception_ptr> errors(n_parts);
+  auto run = [&](const size_t t) {
+    try {
+      f(t);
+    }
+    catch (...) {
+      errors[t] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  size_t t = 1;
+  try {
+    for (; t < n_parts; ++t)
+      threads.push_back(std::thread(run, t));
+  }
+  catch (std::system_error &) {}
+  run(0);
+  for (size_t u = t; u < n_parts; ++u)
+    run(u);
+  for (size_t u = 0; u < threads.size(); ++u)
+    threads[u].join();
+  for (size_t u = 0; u < n_parts; ++u)
+    if (errors[u])
+      std::rethrow_exception(errors[u]);
+}
+
+
+// the number of parts for n_threads, so none is too small to be
+// worth starting a thread for
+static size_t
+n_text_parts(const size_t n_starts, const size_t n_threads) {
+  static const size_t min_part_size = 1ul << 16;
+  return std::max(size_t(1), std::min(n_threads, n_starts/min_part_size));
+}
+
+#endif
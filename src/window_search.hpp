@@ -0,0 +1,215 @@
+/* window_search: what boyer_moore, bit_parallel and z_algorithm do
+ * with a FASTA file once they have a pattern: search it with a sink,
+ * or time the algorithms on it.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: these programs differ only in their algorithms. Each gives
+// "search_fasta_file" a search, which is anything with
+//
+//   template<class Text, class Sink> void operator()(Text &T, Sink &sink)
+//
+// that calls sink(i) for each match at position i of T. The text is a
+// fasta_subset for "--region" and "--seqs", and otherwise a
+// fasta_stream, so it is read only once and never all in memory. With
+// "-p" each match is written as soon as it is found (see writer_sink
+// in match_sink.hpp), and otherwise only counted, so no matches are
+// kept either way. For "-B" each program gives a list of the searches
+// to time, as functions of the text in memory.
+
+#ifndef WINDOW_SEARCH_HPP
+#define WINDOW_SEARCH_HPP
+
+#include "fasta_stream.hpp"
+#include "fasta_index.hpp"
+#include "fasta_window.hpp"
+#include "match_sink.hpp"
+#include "match_writer.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+
+#include <getopt.h>
+
+// Search each window with a matcher that has "search(w, len, report)"
+// and "size()", giving the sink the matches as positions in the text
+template<class Text, class Matcher, class Sink> static void
+search_windows(Text &T, const Matcher &M, Sink &sink) {
+  fasta_for_each_window(T, M.size() - 1,
+                        [&](const char *w, const size_t len, const size_t pos) {
+    M.search(w, len, [&](const size_t i) {sink(pos + i);});
+  });
+}
+
+
+// The options that all the programs have
+struct window_search_options {
+  window_search_options() :
+    print_matches(false), benchmark(false),
+    block_size(fasta_stream::default_block_size) {}
+  bool print_matches;
+  bool benchmark;
+  size_t block_size;
+  std::vector<std::string> regions; // also the names given with "--seqs"
+};
+
+static const struct option window_search_long_options[] = {
+  {"region", required_argument, nullptr, 'r'},
+  {"seqs", required_argument, nullptr, 'S'},
+  {nullptr, 0, nullptr, 0}
+};
+
+
+// Take one of the options above from getopt_long, giving false for any
+// other option
+static bool
+window_search_option(const int opt, const char *arg,
+                     window_search_options &o) {
+  switch (opt) {
+  case 'b':
+    o.block_size = std::strtoul(arg, nullptr, 10) << 20;
+    return true;
+  case 'p':
+    o.print_matches = true;
+    return true;
+  case 'B':
+    o.benchmark = true;
+    return true;
+  case 'r':
+    o.regions.push_back(arg);
+    return true;
+  case 'S':
+    split_fasta_names(arg, o.regions);
+    return true;
+  }
+  return false;
+}
+
+
+// The lines of the usage message for the options above, with "-B"
+// only if "benchmark" says what it times
+static void
+print_window_search_usage(const std::string &benchmark) {
+  std::cerr << "  -b <MB>   block size for reading (default: 1)"
+            << std::endl
+            << "  -p        print each match (sequence name and offset)"
+            << std::endl;
+  if (!benchmark.empty())
+    std::cerr << "  -B        time " << benchmark << std::endl;
+  std::cerr << "  -r, --region <name:start-end>"
+            << std::endl
+            << "            search only this region (can be repeated)"
+            << std::endl
+            << "  --seqs <name,name,...>"
+            << std::endl
+            << "            search only these sequences"
+            << std::endl;
+}
+
+
+// A search to time with "-B": its name, and a function that finds the
+// matches in text t of length m
+struct timed_search {
+  std::string name;
+  std::function<void(const char *, size_t, position_sink &)> search;
+};
+
+
+// Time each search on the same text, which is in memory and in upper
+// case, and check they all find the same matches as the first. The
+// matchers are made before, so only the searches are timed.
+template<class Text> static void
+benchmark_searches(Text &T, const std::vector<timed_search> &searches) {
+  std::string text;
+  text.reserve(T.size());
+  T.for_each_line([&](const char *line, const size_t len, size_t) {
+    for (size_t i = 0; i < len; ++i)
+      text += fasta_upper(line[i]);
+  });
+
+  typedef std::chrono::steady_clock clock;
+  const double megabytes = text.size()/1e6;
+
+  std::cout << "search\tmatches\tseconds\tMB/s" << std::endl;
+  std::vector<size_t> expected;
+  for (size_t s = 0; s < searches.size(); ++s) {
+    position_sink found;
+    const clock::time_point t0 = clock::now();
+    searches[s].search(text.data(), text.size(), found);
+    const std::chrono::duration<double> elapsed = clock::now() - t0;
+    std::cout << searches[s].name << '\t' << found.count() << '\t'
+              << elapsed.count() << '\t' << megabytes/elapsed.count()
+              << std::endl;
+    if (s == 0) expected.swap(found.matches);
+    else if (found.matches != expected)
+      throw std::runtime_error(searches[s].name + " found different matches");
+  }
+}
+
+
+// One pass of the search over T, with each match written as it is
+// found for "-p", and otherwise only counted, giving the number of
+// matches. The records of a fasta_stream grow as it is read, and have
+// the sequence of each match by the time it is found.
+template<class Text, class Search> static size_t
+search_with_sink(Text &T, const size_t n, const bool print_matches,
+                 const Search &search) {
+  if (print_matches) {
+    match_writer out;
+    writer_sink writer(out, T.records(), n);
+    search(T, writer);
+    out.flush();
+    return writer.count();
+  }
+  count_sink counter;
+  search(T, counter);
+  return counter.count();
+}
+
+
+// Search the file for a pattern of length n, or time the searches with
+// "-B", and print the number of matches after any matches
+template<class Search> static void
+search_fasta_file(const std::string &filename, const size_t n,
+                  const window_search_options &o, const Search &search,
+                  const std::vector<timed_search> &benchmarks) {
+  size_t n_matches = 0;
+  if (!o.regions.empty()) {
+    const fasta_index index(filename);
+    fasta_subset T(filename, index, index.parse_regions(o.regions));
+    if (o.benchmark) {
+      benchmark_searches(T, benchmarks);
+      return;
+    }
+    n_matches = search_with_sink(T, n, o.print_matches, search);
+  }
+  else {
+    fasta_stream T(filename, o.block_size);
+    if (o.benchmark) {
+      benchmark_searches(T, benchmarks);
+      return;
+    }
+    n_matches = search_with_sink(T, n, o.print_matches, search);
+  }
+  std::cout << n_matches << std::endl;
+}
+
+#endif
@@ -19,10 +19,35 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Compile with:
+ *
+ * $ c++ -O3 -o z_algorithm z_algorithm.cpp -lz -pthread
+ *
+ * Given one string, this prints a trace of the Z-algorithm on it, one
+ * line for each iteration, and then the Z values. Given a pattern and
+ * a FASTA file (or "-" for standard input), it finds the pattern in
+ * the file using Z values of the pattern only (see z_matcher in
+ * z_algorithm.hpp), without the trace, which would take much longer
+ * than the search itself. The options are the same as for
+ * boyer_moore (see window_search.hpp), so the matches are written as
+ * they are found, or only counted, and the two can be compared with
+ * kmp_fasta on the same files, e.g.:
+ *
+ * $ ./z_algorithm -p ACGTACGA genome.fa
+ */
+
+#include "z_algorithm.hpp"
+#include "window_search.hpp"
+
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <cstdlib>
+#include <stdexcept>
+
+#include <getopt.h>
 
 using std::vector;
 using std::string;
@@ -38,14 +63,12 @@ match(const string &s, size_t q, size_t i) {
   return q;
 }
 
-int main(int argc, const char * const argv[]) {
 
-  if (argc != 2) {
-    std::cerr << "must give a string as input!" << endl;
-    return EXIT_FAILURE;
-  }
-
-  const string s(argv[1]);
+/* The Z-algorithm on "s" with a line for each iteration. The lines
+ * end with '\n' and not endl, so the output is not flushed for each.
+ */
+static void
+z_algorithm_trace(const string &s) {
 
   vector<size_t> Z(s.length());
 
@@ -62,7 +85,7 @@ int main(int argc, const char * const argv[]) {
    * we start at "r" and not "r+1".
    */
 
-  cout << "k" << "\t" << "l" << "\t" << "r" << "\t" << "Z[k]" << endl;
+  cout << "k" << "\t" << "l" << "\t" << "r" << "\t" << "Z[k]" << '\n';
 
   size_t l = 0, r = 0;
   for (size_t k = 1; k < s.length(); ++k) {
@@ -87,16 +110,73 @@ int main(int argc, const char * const argv[]) {
       }
     }
     cout << k + 1 << "\t" << l + 1 << "\t" << r << "\t"
-         << Z[k] << "\t" << the_case << endl;
+         << Z[k] << "\t" << the_case << '\n';
   }
 
-  cout << endl
-       << s << endl
-       << "i\tZ[i]" << endl
-       << "==\t====" << endl;
+  cout << '\n'
+       << s << '\n'
+       << "i\tZ[i]" << '\n'
+       << "==\t====" << '\n';
 
   for (size_t i = 0; i < Z.size(); ++i)
-    cout << i << "\t" << Z[i] << endl;
+    cout << i << "\t" << Z[i] << '\n';
+}
+
 
+// the search given to search_fasta_file (see window_search.hpp)
+struct z_search {
+  template<class Text, class Sink> void
+  operator()(Text &T, Sink &sink) const {
+    search_windows(T, z_matcher(P), sink);
+  }
+  const string &P;
+};
+
+
+static void
+print_usage(const char *prog) {
+  std::cerr << "usage: " << prog << " <string>" << endl
+            << "       " << prog << " [options] <pattern> <fasta-file>"
+            << endl
+            << "options:" << endl;
+  print_window_search_usage("");
+}
+
+
+int main(int argc, char * const argv[]) {
+
+  window_search_options wopt;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "b:pr:",
+                            window_search_long_options, nullptr)) != -1) {
+    if (!window_search_option(opt, optarg, wopt)) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind == 1) {
+    z_algorithm_trace(argv[optind]);
+    return EXIT_SUCCESS;
+  }
+
+  if (argc - optind != 2 || wopt.block_size == 0 || argv[optind][0] == '\0') {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    string P(argv[optind]);
+    std::transform(begin(P), end(P), begin(P), fasta_upper);
+
+    const z_search search = {P};
+    search_fasta_file(argv[optind + 1], P.size(), wopt, search,
+                      vector<timed_search>());
+  }
+  catch (std::exception &e) {
+    std::cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,122 @@
+/* z_algorithm: the Z values of a string, using Dan Gusfield's
+ * Z-algorithm, for programs that need them without the trace printed
+ * by z_algorithm.cpp, and exact matching with the Z-algorithm.
+ *
+ * Copyright (C) 2024 Andrew D. Smith
+ *
+ * Authors: Andrew D. Smith
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+// ADS: Z[k] is the length of the longest substring starting at k that
+// is also a prefix of the string. The cases are the same as in
+// z_algorithm.cpp, where they are explained, and "r" is again the
+// first position outside the rightmost Z-box. Z[0] is not defined in
+// the book; here it is the length of the string.
+
+#ifndef Z_ALGORITHM_HPP
+#define Z_ALGORITHM_HPP
+
+#include "fasta_records.hpp"
+
+#include <string>
+#include <vector>
+
+static inline void
+z_values(const std::string &s, std::vector<size_t> &Z) {
+  const size_t n = s.length();
+  Z.assign(n, 0);
+  if (n == 0) return;
+  Z[0] = n;
+
+  size_t l = 0, r = 0;
+  for (size_t k = 1; k < n; ++k) {
+    size_t q = 0; // how much is already known to match
+    if (k < r) {
+      const size_t k_prime = k - l;
+      const size_t beta_len = r - k;
+      if (Z[k_prime] < beta_len) { // Case 2a: stay inside Z-box
+        Z[k] = Z[k_prime];
+        continue;
+      }
+      q = beta_len; // Case 2b: match past the Z-box
+    }
+    while (k + q < n && s[q] == s[k + q]) ++q;
+    Z[k] = q;
+    if (k + q > r) {
+      l = k;
+      r = k + q;
+    }
+  }
+}
+
+
+// ADS: the usual way to find P in T with the Z-algorithm is to compute
+// Z for P$T, where $ is in neither, and a match is where Z is |P|.
+// But the Z values of the T part only ever compare letters of T with
+// letters of P, and use Z values of the P part to skip comparisons, so
+// P$T never needs to exist. Here Z values of P are computed once, and
+// then for each position k of T we find the length of the longest
+// prefix of P starting at T[k], which is what the Z value at k would
+// be in P$T. The rightmost Z-box [l, r) is now a part of T equal to
+// P[0..r-l), and for k inside it, T[k..r) is equal to P[k-l..r-l), so
+// the Z value of P at k - l says how much of P is matched at k without
+// comparing anything, as in Case 2a and 2b. The Z-boxes are never
+// longer than P, since a comparison with P stops at its end, which
+// takes the place of the $.
+//
+// Each comparison that matches moves r to the right, so the time is
+// linear in the length of T, and only one letter of T is needed ahead
+// of r. The text must be in one piece of memory (see fasta_window.hpp
+// for a FASTA file). Upper and lower case letters of the text are the
+// same, so P must be in upper case.
+class z_matcher {
+public:
+  explicit z_matcher(const std::string &p) : P(p) {z_values(P, Zp);}
+  size_t size() const {return P.length();}
+
+  // report(i) for each position i where P occurs in T[0..m-1], in order
+  template<class Report> void
+  search(const char *T, const size_t m, Report report) const;
+
+private:
+  std::string P;
+  std::vector<size_t> Zp;
+};
+
+
+template<class Report> void
+z_matcher::search(const char *T, const size_t m, Report report) const {
+  const size_t n = P.length();
+  if (n == 0 || m < n) return;
+
+  size_t l = 0, r = 0;
+  for (size_t k = 0; k + n <= m; ++k) {
+    size_t q = 0; // how much of P is already known to match at k
+    if (k < r) {
+      const size_t k_prime = k - l;
+      const size_t beta_len = r - k;
+      if (Zp[k_prime] < beta_len) // Case 2a: stay inside Z-box
+        continue; // Zp[k_prime] < beta_len <= n, so not a match
+      q = beta_len; // Case 2b: match past the Z-box
+    }
+    while (q < n && fasta_upper(T[k + q]) == P[q]) ++q;
+    if (k + q > r) {
+      l = k;
+      r = k + q;
+    }
+    if (q == n)
+      report(k);
+  }
+}
+
+#endif